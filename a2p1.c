@@ -3,13 +3,22 @@
 *	by Kyle Zwarich for CMPUT 379 Assignment 2
 *
 *	Usage:
-*		'a2p1 nLine inputFile delay'
+*		'a2p1 nLine inputFile delay [-j maxJobs] [-f] [-r rate [-b burst]]'
 *	nLine: integer -- 
 			how many text lines to read
 *	inputFile: string --
 			file path to the file to read (real file on disk)
 *	delay: integer --
 			number of milliseconds to delay (converted internally)
+*	-j maxJobs: integer --
+			most commands allowed to run at once (default MAXJOBS)
+*	-f: --
+			follow inputFile as it grows instead of wrapping at its end
+*	-r rate: number --
+			print a steady rate lines per second instead of nLine every delay
+*	-b burst: integer --
+			with -r, most lines printed at once after falling behind
+			(default: nLine, or two ticks' worth if that is more)
 
 *	This program reads from some inputFile,
 	a number of lines nLine, and prints them to
@@ -19,11 +28,55 @@
 *	Commands include the keyword 'quit' to 
 	terminate the program and return to the terminal.
 
-*	Otherwise, the entered command is sent to a 'popen()' function
-	and interpreted by the shell.
+*	Otherwise, the entered command is started with 'posix_spawn()' and
+	interpreted by the shell. Commands run in the background: the main
+	thread is an event loop over stdin and every running command's output
+	pipe, so input is taken and output streamed while commands run.
+	Each command's output is buffered until a whole line is in, then
+	printed with a '[cmd N]' tag; commands beyond maxJobs wait their turn.
 
 *	The program iterates indefinitely until the 'quit' command is issued.
 
+*	Timing: one scheduler thread owns a periodic timerfd armed with the
+	delay; each expiry prints the next nLine lines. The kernel keeps the
+	period on an absolute schedule, so ticks don't drift, and missed ticks
+	are reported rather than queued up as extra threads.
+
+*	Reading: inputFile is memory-mapped and an index of line start offsets
+	is built lazily as lines are first reached, so lines of any length are
+	printed whole, going to line N is a lookup once it is indexed, and
+	wrapping at end of file just starts again at line 0. Each tick's lines
+	are handed to the output writer as pointers into the mapping.
+
+*	Following (-f): inputFile is read into a buffer instead, and lines are
+	printed as they are added to it, still nLine per delay. inotify reports
+	writes to the file and new files taking its name. When every complete
+	line is printed the timer is disarmed, so an idle file costs nothing
+	until it is written again. A file that gets shorter was truncated and
+	is read again from its start; a new file under the same name (log
+	rotation) is read once the old one's remaining lines are in.
+
+*	Rate (-r): a token bucket replaces nLine per delay. Tokens accrue at
+	rate per second up to burst, and each tick prints one line per whole
+	token. Ticks come once per token, but no more often than RATETICKNS,
+	so high rates print a batch of lines per tick. Every RATEREPORT
+	seconds the rate actually reached is reported, with the lines lost
+	to a full bucket while there were lines waiting: how far behind the
+	target printing has fallen.
+
+*	Timing statistics: for every tick the scheduler records how late it woke
+	after the time the tick was due (jitter), and how long printing its
+	batch took, up to handing it to the writer (batch latency). Both go
+	into histograms of power-of-two microsecond buckets, printed on exit
+	and whenever a2p1 gets SIGUSR1 ('kill -USR1 <pid>').
+
+*	Output: once the threads are up nothing calls printf() on stdout.
+	Each thread formats into its own chunk buffer (outPrintf()) and hands
+	it over whole (outFlush()) to one writer thread, which owns stdout and
+	writes everything queued so far in large writev() batches. Chunks are
+	written in the order they were handed over, so one thread's output
+	stays in order and a message is never split by another thread's.
+
 */
 
 #define _GNU_SOURCE 1 // add support for some POSIX related commands
@@ -38,6 +91,20 @@
 #include <unistd.h> //pause()
 #include <pthread.h> //pthread support
 #include <signal.h> //sigaction()
+#include <poll.h> //poll() on the timer and stop descriptors
+#include <stdint.h> //uint64_t expiration counts
+#include <sys/timerfd.h> //timerfd_create()
+#include <sys/eventfd.h> //eventfd() to stop the scheduler
+#include <fcntl.h> //open()
+#include <sys/mman.h> //mmap() the input file
+#include <sys/stat.h> //fstat() for the file size
+#include <sys/uio.h> //writev() batched output
+#include <spawn.h> //posix_spawn() for user commands
+#include <sys/wait.h> //waitpid()
+#include <stdarg.h> //va_list for outPrintf()
+#include <sys/inotify.h> //inotify for follow mode
+#include <time.h> //clock_gettime() for the last tick
+#include <sys/signalfd.h> //signalfd() for SIGUSR1 reports
 
 //
 //macro definitions:
@@ -45,19 +112,129 @@
 #define MAXFD 128 //maximum file descriptor length
 #define MAXCOMMAND 32 //maximum command str length
 #define MAXLINE 255 //maximum line length
+#define INDEXSTART 4096 //line offsets the index starts with; it doubles whenever it fills
+#define MAXIOV 1024 //iovecs per writev() (IOV_MAX on Linux)
+#define MAXJOBS 4 //default cap on commands running at once
+#define MAXJOBSLIMIT 64 //highest cap allowed with -j
+#define MAXPENDING 16 //commands waiting for a free slot
+#define QUITWAIT 500 //ms a command's output may stay quiet at quit before it is killed, then cut off
+#define JOBBUFFER 4096 //bytes of unfinished output line held per command
+#define OUTCHUNK 16384 //bytes of formatted output per chunk
+#define OUTSEGS 256 //pieces of output per chunk
+#define OUTMAXQUEUED 64 //chunks waiting for the writer before producers wait too
+#define FOLLOWREAD 65536 //least buffer space for each read of a followed file
+#define NOTIFYBUFFER 4096 //bytes of inotify events read at once
+#define RATETICKNS 1000000 //shortest tick in rate mode, in nanoseconds
+#define RATEREPORT 1.0 //seconds between rate reports
+#define HISTBUCKETS 32 //power-of-two microsecond buckets per timing histogram
+#define HISTBAR 40 //characters in the longest histogram bar
 
 //
 //user-created structs:
 //
-struct printLineArgs {FILE *fd; fpos_t *startpos; int nlines;};
-struct threadArgs {int delayTime; pthread_t threadID; struct printLineArgs printArgs;};
+struct lineFile {
+	int fd;
+	char *map;			//whole file, read-only; NULL if the file is empty
+	size_t size;
+	size_t *offsets;	//offsets[i - firstLine]: where line i starts; offsets[nLines - firstLine] is where scanning resumes
+	size_t nLines;		//lines indexed so far
+	size_t capacity;	//entries allocated in offsets
+	int complete;		//1 once the whole file is indexed
+	int follow;			//1: map is a buffer read from fd that grows with the file
+	size_t mapCapacity;	//bytes allocated for map when following
+	size_t firstLine;	//when following: lines already dropped from the front of map
+};
+struct follower {
+	int notifyFD;		//inotify instance
+	int fileWatch;		//the file being read
+	int dirWatch;		//its directory, to see a new file take its name
+	char path[MAXFD];
+	char dir[MAXFD];
+	char name[MAXFD];
+	dev_t dev;			//the file being read, to tell whether path is still it
+	ino_t inode;
+};
+struct printLineArgs {struct lineFile *file; size_t *nextLine; int nlines; int printed;};
+struct job {
+	int id;				//0 if the slot is free
+	pid_t pid;
+	int outFD;			//read end of the command's stdout; -1 once it hits EOF
+	char command[MAXCOMMAND];
+	char buffer[JOBBUFFER];	//output not yet printed (an unfinished line)
+	size_t used;
+};
+struct tickArgs {int delayTime; int stopFD; struct printLineArgs printArgs; struct follower *follow; double rate; int burst;};
+struct rateBucket {
+	double rate;					//lines per second
+	int burst;						//most tokens held, so most lines in one tick
+	double tokens;
+	struct timespec lastRefill;
+	struct timespec windowStart;	//start of the current report
+	unsigned long long sent;		//lines printed since windowStart
+	unsigned long long behind;		//tokens lost to a full bucket while lines were waiting, since windowStart
+};
+struct histogram {
+	const char *name;
+	unsigned long long counts[HISTBUCKETS];	//counts[0]: under 1 us; counts[i]: 2^(i-1) us up to 2^i us
+	unsigned long long n;
+	double sumUs;
+	double maxUs;
+};
+struct outChunk {
+	struct outChunk *next;
+	int nSeg;
+	struct iovec seg[OUTSEGS];	//what to write, in order; points into data or at the file mapping
+	size_t used;				//bytes of data taken
+	char data[OUTCHUNK];
+};
+struct outWriter {
+	pthread_mutex_t lock;
+	pthread_cond_t queued;		//writer waits: chunks handed over, or stopping
+	pthread_cond_t drained;		//producers wait: queue back under OUTMAXQUEUED
+	struct outChunk *head;		//handed over and not yet written, oldest first
+	struct outChunk *tail;
+	int nQueued;
+	int busy;					//1 while the writer writes chunks it has taken
+	struct outChunk *spare;		//written chunks kept for reuse
+	int stopping;
+	pthread_t thread;
+};
+
+//
+//global variables:
+//
+static struct outWriter writer = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+static __thread struct outChunk *outCurrent; //this thread's chunk being filled
 
 //
 //function declarations
 //
-void *makeTimer(void *arg);
+void *tickLoop(void *arg);
 void *printLinesFromFile(void *arg);
-void *onAlarmSignal(void *arg);
+double secondsBetween(const struct timespec *from, const struct timespec *to);
+void rateRefill(struct rateBucket *rb, const struct timespec *now, int waiting);
+void rateReport(struct rateBucket *rb, const struct timespec *now);
+void timespecAdd(struct timespec *ts, const struct timespec *add, unsigned long long times);
+void histAdd(struct histogram *h, double us);
+void histPrint(const struct histogram *h);
+int lineFileOpen(struct lineFile *lf, const char *path, int follow);
+void lineFileClose(struct lineFile *lf);
+int lineFileHas(struct lineFile *lf, size_t line);
+ssize_t lineFileFill(struct lineFile *lf, size_t keepLine);
+void lineFileRestart(struct lineFile *lf);
+int followOpen(struct follower *fw, struct lineFile *lf, const char *path);
+void followEvents(struct follower *fw, struct lineFile *lf, size_t keepLine);
+void followClose(struct follower *fw);
+int startCommand(struct job *job, const char *command, int id);
+void readCommandOutput(struct job *job);
+int reapCommand(struct job *job);
+void outStart(void);
+void outStop(void);
+void outPrintf(const char *format, ...);
+void outRef(const void *data, size_t len);
+void outFlush(void);
+void outSync(void);
+void *outLoop(void *arg);
 
 //
 //main function
@@ -69,6 +246,11 @@ int main(int argc, char* argv[]){
 	//1: number of lines to read;
 	//2: fileDescriptor to read;
 	//3: delay in milliseconds
+	//then options: -j maxJobs, -f, -r rate, -b burst
+	if (argc < 4){
+		printf("usage: a2p1 nLine inputFile delay [-j maxJobs] [-f] [-r rate [-b burst]]\n");
+		exit(EXIT_FAILURE);
+	}
 
 	//process arg1
 	int nLines;
@@ -91,93 +273,219 @@ int main(int argc, char* argv[]){
 		exit(EXIT_FAILURE);
 	}
 
+	//process options
+	int maxJobs = MAXJOBS;
+	int follow = 0;
+	double rate = 0;
+	int burst = 0;
+	int opt;
+	optind = 4;
+	while ((opt = getopt(argc, argv, "j:fr:b:")) != -1){
+		switch (opt){
+			case 'j': maxJobs = strtol(optarg, NULL, 10); break;
+			case 'f': follow = 1; break;
+			case 'r': rate = strtod(optarg, NULL); break;
+			case 'b': burst = strtol(optarg, NULL, 10); break;
+			default:
+				printf("usage: a2p1 nLine inputFile delay [-j maxJobs] [-f] [-r rate [-b burst]]\n");
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (maxJobs < 1) maxJobs = 1;
+	if (maxJobs > MAXJOBSLIMIT) maxJobs = MAXJOBSLIMIT;
+	if (rate < 0) rate = 0;
+	if (burst < 0) burst = 0;
+
 		//setup the quit command string;
 	char qCommand[] = "quit";
 
-		//open the file from arg2 for reading:
-	FILE *myFile = fopen(myFD, "r");
-	fpos_t fileStartPos;
-	fileStartPos.__pos = 0;
-	fpos_t fileCurrPos;
-	memset(&fileCurrPos, 0, sizeof(fileCurrPos));
+		//map the file from arg2 for reading (or start following it):
+	struct lineFile myFile;
+	if (lineFileOpen(&myFile, myFD, follow) < 0){
+		printf("a2p1: could not open [%s]: %s\n", myFD, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	struct follower myFollower;
+	if (follow && followOpen(&myFollower, &myFile, myFD) < 0){
+		printf("a2p1: could not watch [%s]: %s\n", myFD, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	size_t fileNextLine = 0;
 
 		//create a struct for dealing with printing
 	struct printLineArgs plArgs;
-	plArgs.fd = myFile;
+	plArgs.file = &myFile;
 	plArgs.nlines = nLines;
-	plArgs.startpos = &fileStartPos;
+	plArgs.nextLine = &fileNextLine;
 
 		//create a string buffer to hold commands;
 	char currCommand[MAXCOMMAND];
 	memset(currCommand, 0, sizeof(currCommand));
 
-		//signal blocking for main thread; don't want to terminate when SIGALRM!
-	sigset_t mySignalSet;
-	sigemptyset(&mySignalSet);
-	sigaddset(&mySignalSet, SIGALRM);
-	pthread_sigmask(SIG_BLOCK, &mySignalSet, NULL);
-
-		//create a struct to pass information through functions
-	struct threadArgs myArguments;
+		//start the scheduler thread; it runs until stopFD is signalled
+	struct tickArgs myArguments;
 	myArguments.delayTime = delayTime;
-	myArguments.threadID = pthread_self();
 	myArguments.printArgs = plArgs;
-	//printf("Parent thread is: [%ld]\n", myArguments.threadID);
-
-		//start handler thread
-	pthread_t myHandlerThread = 0;
-	pthread_create(&myHandlerThread, NULL, &onAlarmSignal, &myArguments);
-		//start alarm thread
-	struct threadArgs handlerArgs;
-	handlerArgs.delayTime = myArguments.delayTime;
-	handlerArgs.threadID = myHandlerThread;
-	handlerArgs.printArgs = plArgs;
-	pthread_t myAlarmThread = 0;
-	pthread_create(&myAlarmThread, NULL, &makeTimer, &handlerArgs);
+	myArguments.follow = follow ? &myFollower : NULL;
+	myArguments.rate = rate;
+	myArguments.burst = burst;
+	if ((myArguments.stopFD = eventfd(0, 0)) < 0){
+		printf("a2p1: could not create stop event: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	//SIGUSR1 is taken by the scheduler through a signalfd: block it before any thread starts
+	sigset_t reportSignals;
+	sigemptyset(&reportSignals);
+	sigaddset(&reportSignals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &reportSignals, NULL);
+
+	//from here on all output goes through the writer thread
+	outStart();
+	pthread_t mySchedulerThread = 0;
+	pthread_create(&mySchedulerThread, NULL, &tickLoop, &myArguments);
 
 	//
-	//	Main loop: uses fgets() from stdin to get user commands.
-	//			user must type 'quit' to exit loop.
+	//	Main loop: an event loop over stdin and the output pipes of running
+	//			commands. user must type 'quit' to exit loop.
 	//			Command entry spans across delay; is constantly running
-	//			on the main thread awaiting input.
+	//			on the main thread awaiting input, even while commands run.
 	//
+	struct job jobs[MAXJOBSLIMIT];
+	memset(jobs, 0, sizeof(jobs));
+	char pending[MAXPENDING][MAXCOMMAND];	//commands waiting for a free slot, oldest first
+	int nPending = 0;
+	int nextJobID = 1;
+	char inputBuffer[MAXCOMMAND];			//stdin bytes not yet ending in a newline
+	size_t inputUsed = 0;
+
+	//pollFDs[0] is stdin, pollFDs[1 + j] is jobs[j]'s output (-1: ignored by poll)
+	struct pollfd pollFDs[MAXJOBSLIMIT + 1];
+	pollFDs[0].fd = STDIN_FILENO;
+	pollFDs[0].events = POLLIN;
+
 	int hasQuit = 0;
 	while (!hasQuit) {
 
-		char userInput[MAXCOMMAND];
-		memset(&userInput, 0, sizeof(userInput));
-		char *userIn = userInput;
-
-		fgets(userIn, MAXCOMMAND, stdin);
-		//process commands;
-		strcpy(currCommand, userIn);
-		currCommand[strlen(currCommand)-1] = '\0'; //eliminate newline char
-		printf("\nCommand [%s] running;\n", currCommand);
-		int strcmpRes = strcmp(currCommand, qCommand);
-		//printf("String comparison result is : %d", strcmpRes);
-
-		//command is 'quit'
-		if (strcmpRes == 0){
-			printf("Quit command entered. Stopping.\n");
-			hasQuit = 1;
-		}
-
-		//command is anything else
-		else {
-			//use popen() to start a new process based on command entered
-			FILE *myPipe = popen(currCommand, "r");
-			char outputLine[MAXLINE];
-			printf("Command output: \n");
-			while((fgets(outputLine, 255, myPipe)) != NULL){
-				printf("%s", outputLine);
+		//hand over everything printed last time round before blocking
+		outFlush();
+
+		//start waiting commands while there are free slots
+		for (int j = 0; j < maxJobs && nPending > 0; j++){
+			if (jobs[j].id != 0) continue;
+			if (startCommand(&jobs[j], pending[0], nextJobID) == 0) nextJobID++;
+			nPending--;
+			memmove(pending[0], pending[1], nPending * MAXCOMMAND);
+		}
+
+		int unreaped = 0;
+		for (int j = 0; j < maxJobs; j++){
+			pollFDs[1 + j].fd = (jobs[j].id != 0) ? jobs[j].outFD : -1;
+			pollFDs[1 + j].events = POLLIN;
+			if (jobs[j].id != 0 && jobs[j].outFD < 0) unreaped = 1;
+		}
+
+		//block until there is input or output; check back on exited commands every 50 ms
+		if (poll(pollFDs, maxJobs + 1, unreaped ? 50 : -1) < 0){
+			if (errno == EINTR) continue;
+			outPrintf("a2p1: poll error: %s\n", strerror(errno));
+			break;
+		}
+
+		//output from running commands
+		for (int j = 0; j < maxJobs; j++){
+			if (jobs[j].id == 0) continue;
+			if (jobs[j].outFD >= 0 && (pollFDs[1 + j].revents & (POLLIN | POLLHUP | POLLERR))){
+				readCommandOutput(&jobs[j]);
 			}
-			pclose(myPipe);
-			printf("Waiting for user command:\n");
+			if (jobs[j].outFD < 0) reapCommand(&jobs[j]);
 		}
+
+		//user input; a command is a whole line
+		if (!(pollFDs[0].revents & (POLLIN | POLLHUP))) continue;
+		ssize_t nread = read(STDIN_FILENO, inputBuffer + inputUsed, sizeof(inputBuffer) - 1 - inputUsed);
+		if (nread <= 0){
+			//stdin closed: treat it like 'quit'
+			strcpy(inputBuffer, "quit\n");
+			nread = 5;
+			inputUsed = 0;
+		}
+		inputUsed += nread;
+
+		char *lineEnd;
+		while (!hasQuit && inputUsed > 0){
+			size_t lineLen, consumed;
+			if ((lineEnd = memchr(inputBuffer, '\n', inputUsed)) != NULL){
+				lineLen = lineEnd - inputBuffer;
+				consumed = lineLen + 1;
+			}
+			//a line longer than a command: the start is one command and the rest the next, as with fgets()
+			else if (inputUsed == sizeof(inputBuffer) - 1){
+				lineLen = consumed = inputUsed;
+			}
+			else break;
+			//process commands;
+			memcpy(currCommand, inputBuffer, lineLen);
+			currCommand[lineLen] = '\0'; //eliminate newline char
+			inputUsed -= consumed;
+			memmove(inputBuffer, inputBuffer + consumed, inputUsed);
+
+			outPrintf("\nCommand [%s] running;\n", currCommand);
+			int strcmpRes = strcmp(currCommand, qCommand);
+
+			//command is 'quit'
+			if (strcmpRes == 0){
+				outPrintf("Quit command entered. Stopping.\n");
+				hasQuit = 1;
+			}
+
+			//command is anything else: queue it; it starts as soon as a slot is free
+			else if (nPending < MAXPENDING){
+				strcpy(pending[nPending++], currCommand);
+			}
+			else{
+				outPrintf("Command [%s] dropped: [%d] commands already waiting.\n", currCommand, MAXPENDING);
+			}
+		}
+	}
+
+	//stop any commands still running and collect them; each runs in its own
+	//process group, so the signal reaches whatever the shell started too.
+	//Output that goes quiet without ending (something that ignores SIGTERM,
+	//or left the group holding the pipe) gets SIGKILL, then is abandoned.
+	for (int j = 0; j < maxJobs; j++){
+		if (jobs[j].id == 0) continue;
+		kill(-jobs[j].pid, SIGTERM);
+		int quiet = 0;
+		while (jobs[j].outFD >= 0){
+			struct pollfd out = {.fd = jobs[j].outFD, .events = POLLIN};
+			if (poll(&out, 1, QUITWAIT) != 0){
+				readCommandOutput(&jobs[j]);
+			}
+			else if (quiet++ == 0){
+				kill(-jobs[j].pid, SIGKILL);
+			}
+			else{
+				close(jobs[j].outFD);
+				jobs[j].outFD = -1;
+			}
+		}
+		waitpid(jobs[j].pid, NULL, 0);
 	}
 
+	//stop the scheduler and wait for it before closing the file it reads:
+	uint64_t stop = 1;
+	if (write(myArguments.stopFD, &stop, sizeof(stop)) != sizeof(stop)){
+		outPrintf("a2p1: could not stop scheduler: %s\n", strerror(errno));
+	}
+	pthread_join(mySchedulerThread, NULL);
+	close(myArguments.stopFD);
+
+	//write out what is left; the writer may still point into the file's mapping
+	outStop();
+
 	//close the file descriptor:
-	fclose(myFile);
+	if (follow) followClose(&myFollower);
+	lineFileClose(&myFile);
 	return 0;
 }
 
@@ -185,128 +493,904 @@ int main(int argc, char* argv[]){
 //other functions
 //
 
-/** onAlarmSignal()
- * This function sets up a handler for SIGALRM
+/** tickLoop()
+ * This function is the scheduler: one long-lived thread that prints lines on
+ * every tick of a periodic timer, until the main thread signals stopFD.
  * 
- * arg[0] : threadArgs struct containing information about specified delay time, calling thread id,
- * 			and a struct of type printLineArgs with data passed through by caller
+ * arg[0] : tickArgs struct containing the delay time in milliseconds, the
+ * 			stop eventfd, a struct of type printLineArgs with data passed through by caller,
+ * 			the follower when following (else NULL), and the rate and burst for rate
+ * 			mode (rate 0: print nlines every delay)
  *
+ * When following, the timer is disarmed once every complete line is printed,
+ * and armed again when inotify reports more, for one delay after the last tick.
+ * In rate mode each tick prints as many lines as the token bucket allows.
+ * Each tick's jitter and batch latency are recorded; the histograms are printed
+ * on SIGUSR1 and when the scheduler stops.
 */
-void *onAlarmSignal(void *arg){
-
-	pthread_t alarmTID = pthread_self();
-	//printf("\nThread started: onAlarmSignal [%ld]\n", alarmTID);
-	sigset_t threadMask;
-	sigemptyset(&threadMask);
-	sigaddset(&threadMask, SIGALRM);
-	//pthread_sigmask(SIG_BLOCK, &threadMask, NULL);
-
-	//pass the arguments along
-	struct threadArgs *passedArgs = arg;
-	struct threadArgs alarmArgs;
-	alarmArgs.delayTime = passedArgs->delayTime;
-	alarmArgs.threadID = alarmTID;
-	alarmArgs.printArgs = passedArgs->printArgs;
-	struct printLineArgs printLines = passedArgs->printArgs;
-
-	//wait for the SIGALRM signal 14, and spawn a new alarm handler if we get one
-	pthread_t newThread = 0;
-	int sigNo = 0;
-	sigwait(&threadMask, &sigNo);
-	printf("Signal received: [%d]\n", sigNo);
-	pthread_create(&newThread, NULL, &onAlarmSignal, &alarmArgs);
-
-	//print from a file
-	printLinesFromFile(&printLines);
-
-	//create a new timer
-	pthread_t newTimer = 0;
-	struct threadArgs timerArgs;
-	timerArgs.delayTime = passedArgs->delayTime;
-	timerArgs.threadID = newThread;
-	pthread_create(&newTimer, NULL, &makeTimer, &timerArgs);
+void *tickLoop(void *arg){
 
-	return NULL;
-}
+	struct tickArgs *myArgs = arg;
+	int time_ms = myArgs->delayTime;
 
-/** makeTimer
-*This function runs a timer as defined by the user on the command line.
-*	Args defined in struct threadArgs:
-*	threadArgs.delayTime (int): delay time in milliseconds
-*	threadArgs.threadID (pthread_t): calling thread id
-*/
-void *makeTimer(void *arg){
-
-	/**
-	//initialize a sigset:
-	sigset_t ignoreAlarm;
-	sigemptyset(&ignoreAlarm);
-	*/
-
-	sigset_t blockedSignals;
-	sigemptyset(&blockedSignals);
-	sigaddset(&blockedSignals, SIGALRM);
-	//add SIGALRM to blocked signals for this thread:
-	pthread_sigmask(SIG_BLOCK, &blockedSignals, NULL);
-	
-	//for debugging:
-	//pthread_t timertID = pthread_self();
-	//printf("\nThread started: makeTimer [%ld]\n", timertID);
-
-	struct threadArgs *myArg = arg;
-	int time_ms = 0;
-	time_ms = myArg->delayTime;
-	pthread_t threadID = 0;
-	threadID = myArg->threadID;
-
-	struct timespec myTimer;
-	myTimer.tv_nsec = (time_ms % 1000) * 1000000;
-	myTimer.tv_sec = time_ms / 1000;
-	printf("Delay timer started: [%ld.%3.3d] seconds.\n", myTimer.tv_sec, (time_ms % 1000));
-	printf("Waiting for user command:\n");
-	nanosleep(&myTimer, NULL);
-
-	//delay done; fire a signal...
-	printf("\nTimer expired. Firing SIGALRM to parent thread [%ld].\n", threadID);
-	pthread_kill(threadID, SIGALRM);
-
-	return((void *)0);
+	//periodic timer; the first expiry is one delay from now
+	int timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timerFD < 0){
+		outPrintf("tickLoop: could not create timer: %s\n", strerror(errno));
+		return NULL;
+	}
+	struct itimerspec myTimer;
+	struct rateBucket bucket;
+	memset(&bucket, 0, sizeof(bucket));
+	bucket.rate = myArgs->rate;
+	if (bucket.rate > 0){
+		//a tick per token, but no faster than RATETICKNS: then each tick takes several
+		double tickNs = 1e9 / bucket.rate;
+		if (tickNs < RATETICKNS) tickNs = RATETICKNS;
+		myTimer.it_interval.tv_sec = (time_t)(tickNs / 1e9);
+		myTimer.it_interval.tv_nsec = (long)(tickNs - myTimer.it_interval.tv_sec * 1e9);
+		bucket.burst = myArgs->burst;
+		if (bucket.burst == 0){
+			double perTick = bucket.rate * tickNs / 1e9;
+			bucket.burst = (2 * perTick > myArgs->printArgs.nlines) ? (int)(2 * perTick + 1) : myArgs->printArgs.nlines;
+		}
+	}
+	else{
+		myTimer.it_interval.tv_sec = time_ms / 1000;
+		myTimer.it_interval.tv_nsec = (time_ms % 1000) * 1000000;
+	}
+	myTimer.it_value = myTimer.it_interval;
+	struct timespec due;	//when the next tick is due
+	clock_gettime(CLOCK_MONOTONIC, &due);
+	timerfd_settime(timerFD, 0, &myTimer, NULL);
+	timespecAdd(&due, &myTimer.it_interval, 1);
+	if (bucket.rate > 0){
+		outPrintf("Rate: [%.10g] lines/s, burst [%d] lines, a tick every [%ld] us.\n", bucket.rate, bucket.burst,
+				(long)(myTimer.it_interval.tv_sec * 1000000 + myTimer.it_interval.tv_nsec / 1000));
+	}
+	else{
+		outPrintf("Delay timer started: [%ld.%3.3d] seconds.\n", myTimer.it_interval.tv_sec, (time_ms % 1000));
+	}
+	outPrintf("Waiting for user command:\n");
+
+	struct follower *follow = myArgs->follow;
+	struct lineFile *lf = myArgs->printArgs.file;
+	size_t *nextLine = myArgs->printArgs.nextLine;
+	struct timespec lastTick;
+	clock_gettime(CLOCK_MONOTONIC, &lastTick);
+	bucket.lastRefill = bucket.windowStart = lastTick;
+	int armed = 1;
+
+	struct histogram jitter, latency;
+	memset(&jitter, 0, sizeof(jitter));
+	memset(&latency, 0, sizeof(latency));
+	jitter.name = "Tick jitter (woke after due)";
+	latency.name = "Batch latency (woke to handed over)";
+	sigset_t reportSignals;
+	sigemptyset(&reportSignals);
+	sigaddset(&reportSignals, SIGUSR1);
+	int signalFD = signalfd(-1, &reportSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	struct pollfd waitFDs[4];
+	waitFDs[0].fd = timerFD;
+	waitFDs[0].events = POLLIN;
+	waitFDs[1].fd = myArgs->stopFD;
+	waitFDs[1].events = POLLIN;
+	waitFDs[2].fd = (follow != NULL) ? follow->notifyFD : -1;
+	waitFDs[2].events = POLLIN;
+	waitFDs[3].fd = signalFD;
+	waitFDs[3].events = POLLIN;
+
+	for (;;){
+		if (poll(waitFDs, 4, -1) < 0){
+			if (errno == EINTR) continue;
+			outPrintf("tickLoop: poll error: %s\n", strerror(errno));
+			break;
+		}
+		if (waitFDs[1].revents & POLLIN) break;	//main thread is quitting
+
+		//SIGUSR1: report the timing so far
+		if (waitFDs[3].revents & POLLIN){
+			struct signalfd_siginfo info;
+			while (read(signalFD, &info, sizeof(info)) == sizeof(info));
+			histPrint(&jitter);
+			histPrint(&latency);
+			outPrintf("Waiting for user command:\n");
+			outFlush();
+		}
+
+		//the followed file changed: if there are lines to print again, the next tick is one delay after the last
+		if (waitFDs[2].revents & POLLIN){
+			followEvents(follow, lf, *nextLine);
+			if (!armed && lineFileHas(lf, *nextLine)){
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				myTimer.it_value.tv_sec = lastTick.tv_sec + myTimer.it_interval.tv_sec;
+				myTimer.it_value.tv_nsec = lastTick.tv_nsec + myTimer.it_interval.tv_nsec;
+				if (myTimer.it_value.tv_nsec >= 1000000000){
+					myTimer.it_value.tv_sec++;
+					myTimer.it_value.tv_nsec -= 1000000000;
+				}
+				//idle for longer than a delay: tick now rather than count the idle time as missed ticks
+				if (myTimer.it_value.tv_sec < now.tv_sec
+						|| (myTimer.it_value.tv_sec == now.tv_sec && myTimer.it_value.tv_nsec < now.tv_nsec)){
+					myTimer.it_value = now;
+				}
+				timerfd_settime(timerFD, TFD_TIMER_ABSTIME, &myTimer, NULL);
+				due = myTimer.it_value;
+				armed = 1;
+				//tokens from the idle time, with nothing waiting; the report starts over
+				if (bucket.rate > 0){
+					rateRefill(&bucket, &now, 0);
+					bucket.windowStart = now;
+					bucket.sent = bucket.behind = 0;
+				}
+			}
+			outFlush();
+		}
+		if (!(waitFDs[0].revents & POLLIN)) continue;
+
+		//expirations since the last read; more than one means ticks were missed
+		//(in rate mode the tokens for them are added by time, so they are not lost)
+		uint64_t expirations = 0;
+		if (read(timerFD, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+		if (expirations > 1 && bucket.rate == 0){
+			outPrintf("\nTimer: [%llu] ticks missed.\n", (unsigned long long)(expirations - 1));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &lastTick);
+		//the tick being run is the last of those expired; the timer never fires early
+		timespecAdd(&due, &myTimer.it_interval, expirations - 1);
+		double lateUs = secondsBetween(&due, &lastTick) * 1e6;
+		histAdd(&jitter, (lateUs > 0) ? lateUs : 0);
+		timespecAdd(&due, &myTimer.it_interval, 1);
+
+		if (bucket.rate > 0){
+			rateRefill(&bucket, &lastTick, follow == NULL || lineFileHas(lf, *nextLine));
+			myArgs->printArgs.nlines = (int)bucket.tokens;
+		}
+		printLinesFromFile(&myArgs->printArgs);
+		if (bucket.rate > 0){
+			bucket.tokens -= myArgs->printArgs.printed;
+			bucket.sent += myArgs->printArgs.printed;
+			if (secondsBetween(&bucket.windowStart, &lastTick) >= RATEREPORT){
+				rateReport(&bucket, &lastTick);
+				outPrintf("Waiting for user command:\n");
+			}
+		}
+		else{
+			outPrintf("Waiting for user command:\n");
+		}
+		outFlush();
+		struct timespec handedOver;
+		clock_gettime(CLOCK_MONOTONIC, &handedOver);
+		histAdd(&latency, secondsBetween(&lastTick, &handedOver) * 1e6);
+
+		//caught up with the followed file: no ticks until it has more
+		if (follow != NULL && !lineFileHas(lf, *nextLine)){
+			struct itimerspec disarm;
+			memset(&disarm, 0, sizeof(disarm));
+			timerfd_settime(timerFD, 0, &disarm, NULL);
+			armed = 0;
+		}
+	}
+	histPrint(&jitter);
+	histPrint(&latency);
+	outFlush();
+
+	close(signalFD);
+	close(timerFD);
+	return NULL;
 }
 
 
 /** printLinesFromFile()
  * 
- * Prints lines from a file descriptor.
+ * Prints lines from a mapped file without copying them: the output chunk
+ * points at the lines in the mapping.
  * Pass through a struct pointer of type printLineArgs:
- * 	FILE *fd: pointer to a file on disk that has been previously opened in 'r' mode;
- * 	fpos_t *startpos: a pointer holding the position to start reading from the descriptor;
- * 	int nlines: number of lines to read from the descriptor.
+ * 	struct lineFile *file: a file opened with lineFileOpen();
+ * 	size_t *nextLine: a pointer holding the line to start printing from;
+ * 	int nlines: number of lines to print;
+ * 	int printed: set to how many file lines were printed (fewer when following).
+ * At end of file "End of file reached." takes the place of a line (it isn't
+ * counted as printed) and printing carries on from line 0; when following,
+ * printing stops there instead, until more lines are added.
 */
 void *printLinesFromFile(void *arg){
 
 	//get the passthru data
 	struct printLineArgs *passedArgs = arg;
-	FILE *fd = passedArgs->fd;
-	fpos_t *startpos = passedArgs->startpos;
+	struct lineFile *lf = passedArgs->file;
+	size_t line = *passedArgs->nextLine;
 	int nlines = passedArgs->nlines;
 
-	//set position based on passed data
-	fsetpos(fd, startpos);
-	for (int j = 0; j < nlines; j++){
-		//print lines
-		char currline[MAXLINE];
-		memset(currline, 0, sizeof(currline));
+	static const char endOfFile[] = "End of file reached.\n";
 
-		if (fgets(currline, sizeof currline, fd) != NULL){
-			printf("%s", currline);
-		}	
+	int printed = 0;
+	for (int j = 0; j < nlines; j++){
+		if (lineFileHas(lf, line)){
+			//point straight into the mapping
+			size_t start = lf->offsets[line - lf->firstLine];
+			size_t end = lf->offsets[line + 1 - lf->firstLine];
+			outRef(lf->map + start, end - start);
+			//a last line without a newline still gets one
+			if (lf->map[end - 1] != '\n') outRef("\n", 1);
+			line++;
+			printed++;
+		}
+		else if (lf->follow){
+			break;
+		}
 		else{
-			printf("End of file reached.\n");
-			rewind(fd);
+			outRef(endOfFile, sizeof(endOfFile) - 1);
+			line = 0;
 		}
 	}
 	//set the new "start" 
-	fgetpos(fd, startpos);
+	*passedArgs->nextLine = line;
+	passedArgs->printed = printed;
+
+	return NULL;
+}
+
+/** secondsBetween()
+ * 
+ * returns the seconds from from to to
+*/
+double secondsBetween(const struct timespec *from, const struct timespec *to){
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/** rateRefill()
+ * 
+ * Add the tokens earned since the last refill, up to the burst size. Tokens
+ * over it are lost; when lines were waiting that counts as falling behind.
+*/
+void rateRefill(struct rateBucket *rb, const struct timespec *now, int waiting){
+	rb->tokens += rb->rate * secondsBetween(&rb->lastRefill, now);
+	rb->lastRefill = *now;
+	if (rb->tokens > rb->burst){
+		if (waiting) rb->behind += (unsigned long long)(rb->tokens - rb->burst);
+		rb->tokens = rb->burst;
+	}
+}
+
+/** rateReport()
+ * 
+ * Print the rate reached since the last report against the target, and
+ * how many lines printing fell behind by, then start a new report.
+*/
+void rateReport(struct rateBucket *rb, const struct timespec *now){
+	double actual = rb->sent / secondsBetween(&rb->windowStart, now);
+	outPrintf("\nRate: [%.0f] lines/s of [%.10g] target ([%.1f%%]); [%llu] lines behind.\n",
+			actual, rb->rate, 100 * actual / rb->rate, rb->behind);
+	rb->windowStart = *now;
+	rb->sent = 0;
+	rb->behind = 0;
+}
+
+/** timespecAdd()
+ * 
+ * Add add to ts times times.
+*/
+void timespecAdd(struct timespec *ts, const struct timespec *add, unsigned long long times){
+	unsigned long long ns = (add->tv_sec * 1000000000ULL + add->tv_nsec) * times + ts->tv_nsec;
+	ts->tv_sec += ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+/** histAdd()
+ * 
+ * Count a sample of us microseconds in its power-of-two bucket.
+*/
+void histAdd(struct histogram *h, double us){
+	int bucket = 0;
+	for (unsigned long long whole = us; whole > 0 && bucket < HISTBUCKETS - 1; whole >>= 1) bucket++;
+	h->counts[bucket]++;
+	h->n++;
+	h->sumUs += us;
+	if (us > h->maxUs) h->maxUs = us;
+}
+
+/** histPrint()
+ * 
+ * Print a histogram's count, mean, max and bucket bounds for the 50th, 99th
+ * and 99.9th percentiles, then a bar for each bucket from the lowest used
+ * to the highest.
+*/
+void histPrint(const struct histogram *h){
+	if (h->n == 0){
+		outPrintf("\n%s: no ticks yet.\n", h->name);
+		return;
+	}
+	//percentile p is under the upper bound of the bucket where the running count reaches it
+	double percents[] = {50, 99, 99.9};
+	unsigned long long bounds[3];
+	unsigned long long most = 0;
+	int low = -1, top = 0;
+	for (int p = 0; p < 3; p++){
+		unsigned long long needed = (unsigned long long)(h->n * percents[p] / 100 + 0.999999);
+		unsigned long long seen = 0;
+		int b = 0;
+		while (b < HISTBUCKETS - 1 && (seen += h->counts[b]) < needed) b++;
+		bounds[p] = 1ULL << b;
+	}
+	for (int b = 0; b < HISTBUCKETS; b++){
+		if (h->counts[b] > most) most = h->counts[b];
+		if (h->counts[b] > 0) top = b;
+		if (h->counts[b] > 0 && low < 0) low = b;
+	}
+
+	outPrintf("\n%s: [%llu] ticks, mean [%.1f] us, max [%.1f] us; p50 < [%llu] us, p99 < [%llu] us, p99.9 < [%llu] us\n",
+			h->name, h->n, h->sumUs / h->n, h->maxUs, bounds[0], bounds[1], bounds[2]);
+	for (int b = low; b <= top; b++){
+		int bar = (int)(h->counts[b] * HISTBAR / most);
+		if (bar == 0 && h->counts[b] > 0) bar = 1;
+		outPrintf("  %10llu - %10llu us: %10llu %.*s\n", (b == 0) ? 0 : 1ULL << (b - 1), 1ULL << b, h->counts[b],
+				bar, "########################################");
+	}
+}
+
+/** lineFileOpen()
+ * 
+ * Map the file at path read-only and start an empty line index. With
+ * follow set, the file is not mapped: lines are read into a buffer as
+ * they are needed (lineFileFill()).
+ * 
+ * returns 0, or -1 with errno set if the file could not be opened or mapped
+*/
+int lineFileOpen(struct lineFile *lf, const char *path, int follow){
+	memset(lf, 0, sizeof(struct lineFile));
+	if ((lf->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+
+	if (follow){
+		lf->follow = 1;
+		lf->mapCapacity = FOLLOWREAD * 2;
+		lf->capacity = INDEXSTART;
+		lf->map = malloc(lf->mapCapacity);
+		lf->offsets = malloc(lf->capacity * sizeof(size_t));
+		if (lf->map == NULL || lf->offsets == NULL){
+			lineFileClose(lf);
+			return -1;
+		}
+		lf->offsets[0] = 0;
+		return 0;
+	}
+
+	struct stat info;
+	if (fstat(lf->fd, &info) < 0){
+		close(lf->fd);
+		return -1;
+	}
+	lf->size = info.st_size;
+	if (lf->size > 0){
+		lf->map = mmap(NULL, lf->size, PROT_READ, MAP_PRIVATE, lf->fd, 0);
+		if (lf->map == MAP_FAILED){
+			close(lf->fd);
+			return -1;
+		}
+		madvise(lf->map, lf->size, MADV_SEQUENTIAL);
+	}
+
+	lf->capacity = INDEXSTART;
+	if ((lf->offsets = malloc(lf->capacity * sizeof(size_t))) == NULL){
+		lineFileClose(lf);
+		return -1;
+	}
+	lf->offsets[0] = 0;
+	lf->complete = (lf->size == 0);
+	return 0;
+}
+
+/** lineFileClose()
+ * 
+ * Unmap and close a file opened with lineFileOpen().
+*/
+void lineFileClose(struct lineFile *lf){
+	if (lf->follow) free(lf->map);
+	else if (lf->map != NULL) munmap(lf->map, lf->size);
+	if (lf->fd >= 0) close(lf->fd);
+	free(lf->offsets);
+	memset(lf, 0, sizeof(struct lineFile));
+	lf->fd = -1;
+}
 
+/** lineFileHas()
+ * 
+ * Make sure line (counting from 0) is in the index, scanning forward from
+ * the last indexed line only as far as needed. When following, only lines
+ * ending in a newline count, and more of the file is read as needed.
+ * 
+ * returns 1 if the file has that line, 0 if it is past the end
+*/
+int lineFileHas(struct lineFile *lf, size_t line){
+	while (line >= lf->nLines && !lf->complete){
+		size_t pos = lf->offsets[lf->nLines - lf->firstLine];
+		char *newline = memchr(lf->map + pos, '\n', lf->size - pos);
+		if (newline == NULL && lf->follow){
+			//an unfinished last line waits for the rest of it
+			if (lineFileFill(lf, line) > 0) continue;
+			break;
+		}
+		size_t next = (newline != NULL) ? (size_t)(newline - lf->map) + 1 : lf->size;
+
+		if (lf->nLines - lf->firstLine + 2 > lf->capacity){
+			size_t *grown = realloc(lf->offsets, 2 * lf->capacity * sizeof(size_t));
+			if (grown == NULL) return 0;
+			lf->offsets = grown;
+			lf->capacity *= 2;
+		}
+		lf->nLines++;
+		lf->offsets[lf->nLines - lf->firstLine] = next;
+		if (next == lf->size && !lf->follow) lf->complete = 1;
+	}
+	return line < lf->nLines;
+}
+
+/** lineFileFill()
+ * 
+ * Following: read what has been added to the file onto the end of the
+ * buffer. To make room, lines before keepLine are dropped first (line
+ * numbers stay the same), then the buffer grows.
+ * 
+ * returns bytes read, 0 if there was nothing new, -1 on error
+*/
+ssize_t lineFileFill(struct lineFile *lf, size_t keepLine){
+	if (lf->mapCapacity - lf->size < FOLLOWREAD){
+		//lines are about to move: the writer has to be done with them
+		outSync();
+		if (keepLine > lf->nLines) keepLine = lf->nLines;
+		size_t drop = lf->offsets[keepLine - lf->firstLine];
+		if (drop > 0){
+			memmove(lf->map, lf->map + drop, lf->size - drop);
+			lf->size -= drop;
+			for (size_t i = keepLine; i <= lf->nLines; i++){
+				lf->offsets[i - keepLine] = lf->offsets[i - lf->firstLine] - drop;
+			}
+			lf->firstLine = keepLine;
+		}
+		if (lf->mapCapacity - lf->size < FOLLOWREAD){
+			char *grown = realloc(lf->map, lf->mapCapacity * 2);
+			if (grown == NULL) return -1;
+			lf->map = grown;
+			lf->mapCapacity *= 2;
+		}
+	}
+
+	ssize_t nread;
+	do{
+		nread = read(lf->fd, lf->map + lf->size, lf->mapCapacity - lf->size);
+	} while (nread < 0 && errno == EINTR);
+	if (nread > 0) lf->size += nread;
+	return nread;
+}
+
+/** lineFileRestart()
+ * 
+ * Following: the file was truncated or replaced, so drop an unfinished
+ * last line; the next read starts a new one.
+*/
+void lineFileRestart(struct lineFile *lf){
+	lf->size = lf->offsets[lf->nLines - lf->firstLine];
+}
+
+/** followOpen()
+ * 
+ * Start watching the file lf reads (opened from path) for writes, and its
+ * directory for a new file under the same name.
+ * 
+ * returns 0, or -1 with errno set
+*/
+int followOpen(struct follower *fw, struct lineFile *lf, const char *path){
+	memset(fw, 0, sizeof(struct follower));
+	strncpy(fw->path, path, MAXFD - 1);
+	char *slash = strrchr(fw->path, '/');
+	if (slash == NULL){
+		strcpy(fw->dir, ".");
+		strcpy(fw->name, fw->path);
+	}
+	else{
+		memcpy(fw->dir, fw->path, (slash == fw->path) ? 1 : slash - fw->path);
+		strcpy(fw->name, slash + 1);
+	}
+
+	struct stat info;
+	if (fstat(lf->fd, &info) < 0) return -1;
+	fw->dev = info.st_dev;
+	fw->inode = info.st_ino;
+
+	if ((fw->notifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) return -1;
+	fw->fileWatch = inotify_add_watch(fw->notifyFD, fw->path, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+	fw->dirWatch = inotify_add_watch(fw->notifyFD, fw->dir, IN_CREATE | IN_MOVED_TO);
+	if (fw->fileWatch < 0 || fw->dirWatch < 0){
+		close(fw->notifyFD);
+		return -1;
+	}
+	return 0;
+}
+
+/** followEvents()
+ * 
+ * Take the waiting inotify events and act on what happened to the file:
+ * a file shorter than what has been read was truncated and is read again
+ * from its start; a new file under its name is switched to, after what is
+ * left of the old one is read in. Appended lines are left for lineFileHas().
+ * keepLine is the next line to print.
+*/
+void followEvents(struct follower *fw, struct lineFile *lf, size_t keepLine){
+	char events[NOTIFYBUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int replaced = 0;
+	ssize_t nread;
+	while ((nread = read(fw->notifyFD, events, sizeof(events))) > 0){
+		for (char *p = events; p < events + nread; ){
+			struct inotify_event *event = (struct inotify_event *)p;
+			if (event->wd == fw->fileWatch && (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF))) replaced = 1;
+			if (event->wd == fw->dirWatch && event->len > 0 && strcmp(event->name, fw->name) == 0) replaced = 1;
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	struct stat info;
+	off_t readPos = lseek(lf->fd, 0, SEEK_CUR);
+	if (fstat(lf->fd, &info) == 0 && info.st_size < readPos){
+		lseek(lf->fd, 0, SEEK_SET);
+		lineFileRestart(lf);
+		outPrintf("\nFollow: [%s] truncated; reading it from the start.\n", fw->path);
+	}
+	if (!replaced) return;
+
+	//moved away with nothing in its place yet: keep reading the old file until something is
+	int newFD = open(fw->path, O_RDONLY | O_CLOEXEC);
+	if (newFD < 0) return;
+	if (fstat(newFD, &info) < 0 || (info.st_dev == fw->dev && info.st_ino == fw->inode)){
+		close(newFD);
+		return;
+	}
+
+	//lines still to come from the old file go first
+	while (lineFileFill(lf, keepLine) > 0);
+	lineFileRestart(lf);
+	close(lf->fd);
+	lf->fd = newFD;
+	fw->dev = info.st_dev;
+	fw->inode = info.st_ino;
+	inotify_rm_watch(fw->notifyFD, fw->fileWatch);
+	fw->fileWatch = inotify_add_watch(fw->notifyFD, fw->path, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+	outPrintf("\nFollow: [%s] replaced; reading the new file.\n", fw->path);
+}
+
+/** followClose()
+ * 
+ * Stop watching a file started with followOpen().
+*/
+void followClose(struct follower *fw){
+	close(fw->notifyFD);
+	fw->notifyFD = -1;
+}
+
+/** startCommand()
+ * 
+ * Start command under '/bin/sh -c' with posix_spawn(), its stdout going to
+ * a pipe the event loop reads, and stdin from /dev/null so it can't take
+ * the user's input.
+ * 
+ * returns 0 and fills in job, or -1 if the command could not be started
+*/
+int startCommand(struct job *job, const char *command, int id){
+	int outPipe[2];
+	if (pipe2(outPipe, O_CLOEXEC) < 0){
+		outPrintf("Command [%s] could not start: %s\n", command, strerror(errno));
+		return -1;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, outPipe[1], STDOUT_FILENO);
+
+	//the command gets the default signal mask, not ours with SIGUSR1 blocked
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	sigset_t noSignals;
+	sigemptyset(&noSignals);
+	posix_spawnattr_setsigmask(&attributes, &noSignals);
+	//its own process group, so quit can signal everything it starts
+	posix_spawnattr_setpgroup(&attributes, 0);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+	char *shellArgs[] = {"sh", "-c", (char *)command, NULL};
+	extern char **environ;
+	pid_t pid;
+	int err = posix_spawn(&pid, "/bin/sh", &actions, &attributes, shellArgs, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attributes);
+	close(outPipe[1]);
+	if (err != 0){
+		outPrintf("Command [%s] could not start: %s\n", command, strerror(err));
+		close(outPipe[0]);
+		return -1;
+	}
+
+	memset(job, 0, sizeof(struct job));
+	job->id = id;
+	job->pid = pid;
+	job->outFD = outPipe[0];
+	strncpy(job->command, command, MAXCOMMAND - 1);
+	outPrintf("[cmd %d] started: [%s]\n", id, command);
+	return 0;
+}
+
+/** readCommandOutput()
+ * 
+ * Read what a command has written and print every complete line, tagged
+ * with the command's number; a partial line waits in the job's buffer
+ * (unless it fills the buffer). At end of output the rest is printed and
+ * the pipe closed.
+*/
+void readCommandOutput(struct job *job){
+	ssize_t nread = read(job->outFD, job->buffer + job->used, JOBBUFFER - job->used);
+	if (nread < 0 && errno == EINTR) return;
+	if (nread > 0) job->used += nread;
+
+	size_t printed = 0;
+	char *lineEnd;
+	while ((lineEnd = memchr(job->buffer + printed, '\n', job->used - printed)) != NULL){
+		int lineLen = lineEnd - (job->buffer + printed);
+		outPrintf("[cmd %d] %.*s\n", job->id, lineLen, job->buffer + printed);
+		printed += lineLen + 1;
+	}
+	//no newline in a full buffer, or no more output coming: print what's there
+	if ((nread <= 0 || (job->used == JOBBUFFER && printed == 0)) && printed < job->used){
+		outPrintf("[cmd %d] %.*s\n", job->id, (int)(job->used - printed), job->buffer + printed);
+		printed = job->used;
+	}
+	job->used -= printed;
+	memmove(job->buffer, job->buffer + printed, job->used);
+
+	if (nread <= 0){
+		close(job->outFD);
+		job->outFD = -1;
+	}
+}
+
+/** reapCommand()
+ * 
+ * Collect a command whose output has ended, without blocking, and free
+ * its slot.
+ * 
+ * returns 1 if it was collected, 0 if it is still running
+*/
+int reapCommand(struct job *job){
+	int status;
+	if (waitpid(job->pid, &status, WNOHANG) != job->pid) return 0;
+	if (WIFEXITED(status)){
+		outPrintf("[cmd %d] [%s] finished: exit [%d]\n", job->id, job->command, WEXITSTATUS(status));
+	}
+	else{
+		outPrintf("[cmd %d] [%s] finished: signal [%d]\n", job->id, job->command, WTERMSIG(status));
+	}
+	outPrintf("Waiting for user command:\n");
+	job->id = 0;
+	return 1;
+}
+
+/** outStart()
+ * 
+ * Start the writer thread. After this, threads print with outPrintf() and
+ * outRef() and hand their output over with outFlush().
+*/
+void outStart(void){
+	writer.stopping = 0;
+	pthread_create(&writer.thread, NULL, &outLoop, NULL);
+}
+
+/** outStop()
+ * 
+ * Hand over this thread's output, let the writer write everything queued
+ * and wait for it to finish. Other threads must have flushed already.
+*/
+void outStop(void){
+	outFlush();
+	pthread_mutex_lock(&writer.lock);
+	writer.stopping = 1;
+	pthread_cond_signal(&writer.queued);
+	pthread_cond_broadcast(&writer.drained);
+	pthread_mutex_unlock(&writer.lock);
+	pthread_join(writer.thread, NULL);
+
+	while (writer.spare != NULL){
+		struct outChunk *chunk = writer.spare;
+		writer.spare = chunk->next;
+		free(chunk);
+	}
+}
+
+/** outReserve()
+ * 
+ * Get this thread's chunk with room for one more piece of output and at
+ * least bytes of data, handing over the current chunk if it is too full.
+ * A chunk with nothing in it is returned even if bytes is more than it has.
+ * 
+ * returns the chunk, or NULL if there was no memory for one
+*/
+static struct outChunk *outReserve(size_t bytes){
+	struct outChunk *chunk = outCurrent;
+	if (chunk != NULL && chunk->nSeg < OUTSEGS && OUTCHUNK - chunk->used >= bytes) return chunk;
+	outFlush();
+
+	pthread_mutex_lock(&writer.lock);
+	if ((chunk = writer.spare) != NULL) writer.spare = chunk->next;
+	pthread_mutex_unlock(&writer.lock);
+	if (chunk == NULL && (chunk = malloc(sizeof(struct outChunk))) == NULL) return NULL;
+
+	chunk->next = NULL;
+	chunk->nSeg = 0;
+	chunk->used = 0;
+	outCurrent = chunk;
+	return chunk;
+}
+
+/** outSegment()
+ * 
+ * Add len bytes at data as the next piece of chunk, joining it onto the
+ * last piece when it carries straight on from it.
+*/
+static void outSegment(struct outChunk *chunk, const void *data, size_t len){
+	if (len == 0) return;
+	if (chunk->nSeg > 0){
+		struct iovec *last = &chunk->seg[chunk->nSeg - 1];
+		if ((char *)last->iov_base + last->iov_len == data){
+			last->iov_len += len;
+			return;
+		}
+	}
+	chunk->seg[chunk->nSeg].iov_base = (void *)data;
+	chunk->seg[chunk->nSeg].iov_len = len;
+	chunk->nSeg++;
+}
+
+/** outPrintf()
+ * 
+ * printf() into this thread's chunk. Nothing is written until outFlush().
+ * Text longer than a whole chunk is cut short.
+*/
+void outPrintf(const char *format, ...){
+	struct outChunk *chunk = outReserve(1);
+	if (chunk == NULL) return;
+
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(chunk->data + chunk->used, OUTCHUNK - chunk->used, format, args);
+	va_end(args);
+	if (len < 0) return;
+
+	//didn't fit: format it again at the start of a fresh chunk
+	if ((size_t)len >= OUTCHUNK - chunk->used){
+		if ((chunk = outReserve(len + 1)) == NULL) return;
+		va_start(args, format);
+		vsnprintf(chunk->data + chunk->used, OUTCHUNK - chunk->used, format, args);
+		va_end(args);
+		if ((size_t)len >= OUTCHUNK - chunk->used) len = OUTCHUNK - chunk->used - 1;
+	}
+	outSegment(chunk, chunk->data + chunk->used, len);
+	chunk->used += len;
+}
+
+/** outRef()
+ * 
+ * Add len bytes at data to this thread's output without copying them.
+ * data has to stay unchanged until the writer is done with it: until
+ * outStop() returns.
+*/
+void outRef(const void *data, size_t len){
+	struct outChunk *chunk = outReserve(0);
+	if (chunk != NULL) outSegment(chunk, data, len);
+}
+
+/** outFlush()
+ * 
+ * Hand this thread's chunk to the writer, behind everything handed over
+ * before it. Waits while the writer is OUTMAXQUEUED chunks behind.
+*/
+void outFlush(void){
+	struct outChunk *chunk = outCurrent;
+	if (chunk == NULL || chunk->nSeg == 0) return;
+	outCurrent = NULL;
+
+	pthread_mutex_lock(&writer.lock);
+	while (writer.nQueued >= OUTMAXQUEUED && !writer.stopping){
+		pthread_cond_wait(&writer.drained, &writer.lock);
+	}
+	if (writer.tail != NULL) writer.tail->next = chunk;
+	else writer.head = chunk;
+	writer.tail = chunk;
+	writer.nQueued++;
+	pthread_cond_signal(&writer.queued);
+	pthread_mutex_unlock(&writer.lock);
+}
+
+/** outSync()
+ * 
+ * Hand over this thread's output and wait until the writer has written
+ * everything handed over so far, so nothing it points at is still needed.
+*/
+void outSync(void){
+	outFlush();
+	pthread_mutex_lock(&writer.lock);
+	while ((writer.head != NULL || writer.busy) && !writer.stopping){
+		pthread_cond_wait(&writer.drained, &writer.lock);
+	}
+	pthread_mutex_unlock(&writer.lock);
+}
+
+/** outWriteAll()
+ * 
+ * writev() all of iov, carrying on after short writes. Errors drop the
+ * output: there is nowhere left to report them.
+*/
+static void outWriteAll(struct iovec *iov, int n){
+	while (n > 0){
+		ssize_t written = writev(STDOUT_FILENO, iov, n);
+		if (written < 0){
+			if (errno == EINTR) continue;
+			return;
+		}
+		while (n > 0 && (size_t)written >= iov->iov_len){
+			written -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0){
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+}
+
+/** outLoop()
+ * 
+ * The writer thread: the only thread that writes to stdout. Each time
+ * round it takes every chunk queued so far and writes them in as few
+ * writev() calls as MAXIOV allows, until outStop() and the queue is empty.
+*/
+void *outLoop(void *arg){
+	struct iovec batch[MAXIOV];
+
+	pthread_mutex_lock(&writer.lock);
+	for (;;){
+		while (writer.head == NULL && !writer.stopping){
+			pthread_cond_wait(&writer.queued, &writer.lock);
+		}
+		if (writer.head == NULL) break;
+
+		struct outChunk *chunks = writer.head;
+		writer.head = writer.tail = NULL;
+		writer.nQueued = 0;
+		writer.busy = 1;
+		pthread_cond_broadcast(&writer.drained);
+		pthread_mutex_unlock(&writer.lock);
+
+		int nBatch = 0;
+		struct outChunk *last = chunks;
+		for (struct outChunk *chunk = chunks; chunk != NULL; chunk = chunk->next){
+			for (int s = 0; s < chunk->nSeg; s++){
+				if (nBatch == MAXIOV){
+					outWriteAll(batch, nBatch);
+					nBatch = 0;
+				}
+				batch[nBatch++] = chunk->seg[s];
+			}
+			last = chunk;
+		}
+		outWriteAll(batch, nBatch);
+
+		//keep the written chunks for reuse
+		pthread_mutex_lock(&writer.lock);
+		last->next = writer.spare;
+		writer.spare = chunks;
+		writer.busy = 0;
+		pthread_cond_broadcast(&writer.drained);
+	}
+	pthread_mutex_unlock(&writer.lock);
 	return NULL;
 }
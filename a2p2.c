@@ -2,16 +2,102 @@
 *   a2p2 - For CMPUT 379 Winter 2024 by Kyle Zwarich
 
     This program can be started as a "server":
-        ./a2p2 -s
+        ./a2p2 -s [-n objects] [-m bytes] [-l ms] [-t ms] [-T file] [-p bytes]
+                  [-d dir] [-R socket | -r socket] [-w weights] [-E backend] [-C file]
+                  [-B us] [-o dir]
+            -n: size of the object table (default NOBJECT);
+            -m: cache mode; keep at most this many bytes of object names and
+                data resident, evicting cold objects (CLOCK) to make room;
+            -l: longest read lease granted to a caching client (default MAXLEASE);
+            -t: sample the server's own resource use every ms milliseconds, one
+                CSV row per sample: requests served, CPU time, RSS, page faults,
+                context switches and the bytes queued in each client's fifos;
+            -T: file for the samples (default TELEMETRYFILE);
+            -p: resize every client fifo to this many bytes (F_SETPIPE_SZ; the
+                kernel rounds up to a power-of-two number of pages);
+            -d: keep the client fifos in dir instead of the working directory;
+            -R: primary; listen on the unix socket for up to MAXREPLICA replicas
+                and stream every put and delete to them;
+            -r: replica of the primary listening on socket; serve get, list,
+                gtime, stats, watch and leases from a copy of its table, refuse
+                put and delete, and reconnect (catching up from the primary's
+                change log, or a full snapshot) if the link drops;
+            -w: comma-separated scheduling weights for clients 1, 2, ... (default
+                1 each); a client with twice the weight gets twice the service
+                when clients compete;
+            -E: how the server waits for and moves client frames: poll (the
+                default: poll(), then a read or writev per ready fifo), uring
+                (io_uring: a multishot read per client into its own ring of
+                provided buffers, and every reply write of a round submitted
+                in the same io_uring_enter that waits), or sqpoll (uring with a
+                kernel thread polling the submission queue, so a busy server
+                submits without system calls; it only pays with a spare CPU for
+                that thread). Not with -R or -r;
+            -C: capture every request received to file, for replay (-y): per
+                request the microseconds since the one before, the client id and
+                the frame cut after its last nonzero byte, buffered (CAPTUREBUFFER)
+                and flushed whenever the server goes idle;
+            -B: busy-poll: when there is nothing to serve, check the fifos
+                without blocking for up to us microseconds before sleeping in
+                poll() (or io_uring), saving the sleep and wake-up when the next
+                request comes soon. The spin budget adapts to recent arrivals:
+                it doubles (up to us) after a sleep a longer spin would have cut
+                short, and halves after a sleep longer than us, so a server that
+                goes idle soon stops spinning;
+            -o: cold tier: instead of dropping the objects cache mode evicts
+                (-m, or a full table of -n slots), append them to log segments
+                of SEGMENTBYTES in dir, found again through an in-memory key
+                directory. A Bloom filter over the cold names answers most gets
+                and deletes of absent names without touching it, a get of a cold
+                object reads it back into the table, and segments that are
+                mostly dead (deleted, rewritten or read back) are compacted a
+                few records per server round. The segments only hold what is
+                cold now: they are removed when the server exits. Not with -R
+                or -r.
 
     This program can be started as a "client" with an inputFile "file":
-        ./a2p2 -c file
+        ./a2p2 -c file [-L ms] [-d dir[,dir...]] [-P depth] [-D ms] [-a retries] [-N] [idNumber]
+            -L: cache objects from get for up to ms milliseconds under a server
+                lease; the server invalidates the copy if the object changes;
+            -d: talk to the server (or replica) whose fifos are in dir; given
+                several (up to MAXSHARD), each is a shard: every object name
+                belongs to one of them by jump consistent hash, list, stats,
+                watch and quit go to all of them, and gtime to the first;
+            -P: keep up to depth put/get/delete requests in flight per shard
+                instead of waiting for each reply (at most MAXPIPE); any other
+                command first waits for all outstanding replies;
+            -D: give every request a deadline ms after it is sent; a request with
+                no reply by then is retried (a new request, after a jittered
+                backoff that doubles each time) if running it twice is harmless,
+                and otherwise given up. Without -D the client waits forever;
+            -a: retries of a timed-out request before giving up (default RETRIES);
+            -N: send puts and deletes that carry no version condition without
+                asking for a reply (fire and forget): the server applies them in
+                order with the client's other requests but sends no ack, so the
+                client never waits on them and never learns if one failed.
 
-    This program requires two system FIFO file descriptors in the working directory:
-        ./fifo-0-1
-        ./fifo-1-0
+    This program can be run as a microbenchmark suite, writing CSV results to "out":
+        ./a2p2 -b [out]
+            -times the tokenizer, frame packing, frame transfer over a FIFO pair and
+                object table operations; one line per benchmark (default bench.csv).
 
-    If invoked as -s, the idNumber is 0; If invoked as -c, the idNumber is 1;
+    This program can replay a capture (-C) against a server, and report what it reached:
+        ./a2p2 -y capture [-d dir] [-S scale] [-P depth]
+            -d: the server's fifo directory (default .);
+            -S: 1 (the default) sends each request at its captured time, 2 twice
+                as fast, 0.5 half as fast, 0 as fast as replies allow;
+            -P: requests one client can have awaiting replies (default REPLAYDEPTH,
+                at most MAXPIPE); a client at the limit falls behind schedule.
+            -prints requests sent and answered, throughput, latency percentiles
+                (send to first reply frame) and how far behind schedule sends got.
+
+    This program requires two system FIFO file descriptors in the working directory
+    for each client idNumber (1 to NCLIENT); the server creates any that are missing:
+        ./fifo-0-idNumber
+        ./fifo-idNumber-0
+
+    If invoked as -s, the idNumber is 0; If invoked as -c, the idNumber is 1 unless
+    given, and the client only carries out the lines of "file" for its idNumber.
 
     This program imitates a "file-sharing, client/server interaction."
     An inputFile "file" has the following features:
@@ -21,9 +107,13 @@
     
     Instructions include the following:
         ##put/get/delete command
-        "idNumber (put | get | delete) objectName"
+        "idNumber (put | get | delete) objectName [version]"
             -the client with idNumber sends the server a put, get, or delete request
             -an object name has MAXWORD = 32 characters.
+            -every object carries a version number that increases with each change;
+                get reports it. A put or delete given a version only succeeds if the
+                object is still at that version (version 0 on a put means "must not
+                exist yet"), which lets a client update an object without a race.
 
         ##gtime command
         "idNumber gtime"
@@ -34,6 +124,24 @@
             -the client with idNumber delays reading and processing inputFile for
                 x milliseconds
         
+        ##list command
+        "idNumber list [prefix]"
+        "idNumber list low high"
+            -the client with idNumber asks the server for the names it holds,
+                either all names starting with prefix, or all names in the
+                range [low, high); results come back in pages of LISTPAGE names.
+
+        ##watch/unwatch command
+        "idNumber (watch | unwatch) prefix"
+            -the client with idNumber starts (or stops) watching every object whose
+                name starts with prefix; the server pushes a notify frame to it
+                whenever such an object is put or deleted, until it quits.
+
+        ##stats command
+        "idNumber stats"
+            -the client with idNumber asks the server for its counters (table
+                use, get hit rate, evictions, resident bytes, the cold tier).
+
         ##quit command
         "idNumber quit"
             -the client with idNumber terminates normally.
@@ -43,12 +151,40 @@
             NOBJECT = 16
         * updates the "object" table as required by clients;
         * sends an "object" to client (if the object exists);
+        * keeps an ordered index of object names for list requests;
         * reports errors if any problems occur;
+        * reads ahead up to INQUEUE requests per client and serves them in
+            weighted fair order across clients (start-time fair queueing):
+            each request charges its client virtual time by its class (a
+            write costs more than a read), and control requests get a head
+            start, so a gtime or quit isn't stuck behind other clients' puts.
+            Each client's own requests are still served in the order sent;
+        * drops, unanswered, a request whose deadline passed while it waited
+            (its client has stopped waiting for it), and tags every reply with
+            the sequence number of the request it answers;
+        * answers with one frame carrying both status and result where it can:
+            a put or delete with an ack holding the new version or an error, a
+            found get with the object (and its version), a gtime with the time;
+        * runs until SIGINT or SIGTERM, then takes a last telemetry sample and
+            closes its capture, replication socket and cold tier before exiting;
+        * never blocks on a client: replies wait in a per-client queue for
+            room in its fifo, and a client's requests aren't read while its
+            queue is over REPLYHIGHWATER frames;
+        * as a primary, numbers its changes, keeps the last REPLLOG of them,
+            feeds each replica from that log as its socket drains, and drops a
+            replica that falls a whole log behind (it resyncs from a snapshot).
+            Cache-mode evictions aren't replicated: a replica with its own -m
+            evicts on its own;
+        * with a cold tier (-D), keeps hot objects in the table exactly as
+            without one, and spills the ones it evicts to disk; only a miss in
+            the table pays for the tier (a Bloom filter probe, then a key
+            directory lookup, then a read).
 */
 
 //
 //feature test macros (if needed)
 //
+#define _GNU_SOURCE 1 //F_GETPIPE_SZ
 
 //
 //header includes
@@ -68,6 +204,19 @@
 #include <errno.h> //errno defs
 #include <time.h> //timer
 #include <sys/times.h> //times
+#include <limits.h> //INT_MAX, the last version
+#include <stdarg.h> //va_list for stats lines
+#include <sys/wait.h> //waitpid
+#include <sys/ioctl.h> //FIONREAD
+#include <sys/resource.h> //getrusage for telemetry
+#include <sys/uio.h> //writev for reply queues
+#include <stdint.h> //uint64_t for the shard hash
+#include <sys/socket.h> //replication links
+#include <sys/un.h> //unix socket addresses
+#include <signal.h> //ignore SIGPIPE from a replica that went away; stop on SIGINT/SIGTERM
+#include <sys/mman.h> //mmap for the io_uring rings
+#include <sys/syscall.h> //io_uring_setup/enter/register (no liburing needed)
+#include <linux/io_uring.h> //io_uring structures
 
 //
 //macros
@@ -78,12 +227,61 @@
 #define MAXLINELENGTH 80 //max number of characters in a file block line
 #define MAXLINE 256 //used for tokenizer to handle full lines
 #define MAX_NTOKENS 5 //used for tokenizer to handle command splits
+#define SKIPLEVELS 8 //levels in the skiplist name index (good for ~64k objects)
+#define LISTBATCH 8 //object names carried in one list reply frame
+#define LISTPAGE 32 //max object names returned for one list request
+#define MAXSTATLINES 24 //max text lines in one stats report
+#define NCLIENT 3 //max clients (ids 1..NCLIENT), each with its own fifo pair
+#define MAXWATCH 4 //name prefixes one client can watch
+#define NOTIFYBATCH 6 //change events carried in one notify frame
+#define WATCHQUEUE 16 //notify frames held for a slow watcher before events are dropped
+#define MAXLEASE 5000 //default longest read lease the server grants, in ms
+#define LEASESLOTS 64 //leases tracked per client (direct-mapped by name hash)
+#define CLIENTCACHE 64 //objects a caching client keeps (direct-mapped by name hash)
+#define BENCHITERS 200000 //iterations for each in-memory microbenchmark
+#define BENCHFIFOITERS 20000 //round trips for the FIFO microbenchmark
+#define BENCHOBJECTS 4096 //objects in the table for table microbenchmarks
+#define TELEMETRYFILE "telemetry.csv" //default file for server resource samples
+#define TELEMETRYBUFFER 65536 //stdio buffer for the samples file
+#define REPLYQUEUE 256 //frames queued per client for its fifo
+#define REPLYHIGHWATER 128 //stop reading a client's requests while this many replies wait
+#define MAXREPLICA 4 //replicas one primary streams to
+#define REPLLOG 4096 //recent changes a primary keeps for replicas catching up
+#define REPLBEAT 200 //ms between a primary's position frames to its replicas
+#define REPLRETRY 1000 //ms between a replica's attempts to reach its primary
+#define REPLREAD 64 //frames read from a replication link at once
+#define REPLACKS 16 //acks a replica can have waiting for its primary
+#define REPLQUEUE 512 //changes queued for a replica's socket beyond a snapshot's worth
+#define INQUEUE 32 //requests read ahead from one client's fifo
+#define SERVEBATCH 64 //requests served per poll round, across all clients
+#define MAXSHARD 8 //servers one client spreads its objects over
+#define MAXPIPE 64 //requests a client can have in flight to one server
+#define RETRIES 3 //default retries of a timed-out request (with -D)
+#define RETRYBASE 10 //ms backoff before the first retry, doubling for each one after
+#define RETRYCAP 1000 //longest ms backoff between retries
+#define CAPTUREMAGIC "A2P2CAP1" //first bytes of a capture file
+#define CAPTUREBUFFER (1 << 20) //stdio buffer for the capture file
+#define REPLAYDEPTH 32 //default requests one replayed client has awaiting replies
+#define REPLAYIDLE 2000 //ms a replay waits for replies still missing once all is sent
+#define URINGENTRIES 64 //io_uring submission queue entries
+#define SPINSTART 10 //us busy-poll budget once a sleep shows spinning would pay
+#define SEGMENTBYTES (1 << 20) //cold tier: the active segment rolls over past this size
+#define MAXSEGMENTS 256 //cold tier segments at once
+#define KEYDIRSTART 1024 //initial cold tier key directory slots (a power of 2)
+#define BLOOMHASHES 4 //bits set per name in the cold tier's Bloom filter
+#define COMPACTSTEP 32 //cold records compaction examines per server round
+#define URINGBUFS 4 //provided buffers per client for multishot reads (a power of 2)
+#define URINGBUFLEN (INQUEUE * sizeof(FRAME)) //bytes in each; a frame may span two
+#define URINGIDLE 1000 //ms the sqpoll kernel thread spins before it sleeps
+#define URING_READ_MULTISHOT 49 //IORING_OP_READ_MULTISHOT (Linux 6.7), newer than some installed headers
+#define REPLPOLL (2 * NCLIENT) //pollFDs slot of the listening socket, or the link to the primary
+#define NPOLL (REPLPOLL + 1 + MAXREPLICA) //client fifos, that slot, then one per replica
 
 //
 //function/user struct definitions
 //
-typedef enum KIND {get, put, delete, gtime, delay, reqid, ack, done, quit, invalid, stime} KIND;
-char commandList[][MAXWORD] = {"get", "put", "delete", "gtime", "delay", "reqid", "ack", "done", "quit", "invalid", "stime"};
+typedef enum KIND {get, put, delete, gtime, delay, reqid, ack, done, quit, invalid, stime, list, stats, watch, unwatch, notify, lease, inval, repl} KIND;
+char commandList[][MAXWORD] = {"get", "put", "delete", "gtime", "delay", "reqid", "ack", "done", "quit", "invalid", "stime", "list", "stats", "watch", "unwatch", "notify", "lease", "inval", "repl"};
 
 typedef struct intMsg {
     int clientID;
@@ -99,13 +297,439 @@ typedef struct strMsg {
 
 typedef struct sObject {
     int owner;
+    int version;                //increases on every change; expected version on conditional put/delete
     char name[MAXWORD]; 
     strMsg package;
 } sObject;
 
-typedef union { intMsg mInt; strMsg mStr; sObject mObj; } PACKAGE;
+//scheduling classes: virtual time charged per request, and the head start
+//a request of the class gets over other clients' queued requests
+typedef enum PRIO {pr_control, pr_read, pr_write, NPRIO} PRIO;
+char prioList[][MAXWORD] = {"control", "read", "write"};
+double prioCost[] = {1, 1, 4};
+double prioLead[] = {16, 0, 0};
+
+//result carried in an ack's argument: a version (>= 0) or one of these errors
+#define ANYVERSION -1 //version on a put/delete request with no condition attached
+#define MAXVERSION INT_MAX //last version handed out; versions never wrap into the STATUS codes
+typedef enum STATUS {st_ok = 0, st_notfound = -1, st_exists = -2, st_full = -3, st_conflict = -4, st_badversion = -5, st_readonly = -6} STATUS;
+char statusList[][MAXWORD] = {"ok", "not found", "already exists", "table full", "version conflict", "bad version", "read only replica"};
+
+typedef struct listMsg {
+    int prefix;                 //1: match names starting with low; 0: range [low, high)
+    int limit;                  //max names wanted in this page
+    char low[MAXWORD];
+    char high[MAXWORD];         //empty string means no upper bound
+    char cursor[MAXWORD];       //resume after this name; empty for first page
+} listMsg;
+
+typedef struct nameMsg {
+    int count;                  //names used in this frame
+    int last;                   //1 if this is the last frame of the page
+    int more;                   //1 if names remain past this page (resume from names[count-1])
+    char names[LISTBATCH][MAXWORD];
+} nameMsg;
+
+typedef struct eventMsg {
+    int count;                  //events used in this frame
+    int dropped;                //events lost before this frame because the watcher fell behind
+    struct {
+        KIND op;                //put or delete
+        int version;            //version written, or deleted
+        char name[MAXWORD];
+    } events[NOTIFYBATCH];
+} eventMsg;
+
+typedef union { intMsg mInt; strMsg mStr; sObject mObj; listMsg mList; nameMsg mNames; eventMsg mEvents; } PACKAGE;
 typedef struct DATA { int TYPE; PACKAGE package; } DATA;
-typedef struct {KIND kind; DATA data;} FRAME;
+//seq: the client's number for a request, echoed in every reply to it (0 on frames nobody asked for);
+//deadline: monotonicMs() after which the client has stopped waiting for the request (0: never)
+//flags: FR_ bits
+#define FR_NOREPLY 1 //a put or delete the client wants no reply to
+typedef struct {KIND kind; int seq; long deadline; int flags; DATA data;} FRAME;
+
+//cold tier (-D): evicted objects appended to log segments on disk; the key
+//directory says where each one's latest record is, and a record nobody points
+//at any more is dead space, reclaimed when its segment is compacted
+typedef struct coldRecord {
+    int owner;
+    int version;
+    uint8_t len[4];             //name, data1, data2, data3; the strings follow, unterminated
+} coldRecord;
+
+typedef struct coldEntry {
+    char name[MAXWORD];         //empty if the keydir slot is free
+    int version;
+    int segment;
+    int len;                    //record bytes, header included
+    long offset;
+} coldEntry;
+
+typedef struct coldSegment {
+    int fd;                     //-1 if unused
+    long bytes;                 //appended so far
+    long dead;                  //of those, in records no entry points at
+    int stuck;                  //compaction failed on it; it is left as it is
+} coldSegment;
+
+typedef struct coldStore {
+    const char *dir;
+    coldSegment segments[MAXSEGMENTS];
+    int active;                 //segment appended to
+    coldEntry *keydir;          //open addressing, linear probing by nameHash()
+    int capacity;               //keydir slots, a power of 2
+    int count;                  //cold objects
+    unsigned char *bloom;       //8 bits per keydir slot, over the names in the keydir
+    int bloomStale;             //names dropped since the filter was built
+    int compacting;             //segment being compacted, -1 if none
+    long compactAt;             //offset of the next record it examines
+    long spilled, fetched, dropped;
+    long bloomSkips, falseHits; //lookups the filter answered; lookups it let through in vain
+    long compactions, moved;    //segments reclaimed; live bytes copied out of them
+} coldStore;
+
+//server object table; objects live in fixed slots, and a skiplist
+//threads the used slots in name order for lookups and list scans.
+typedef struct nameIndex {
+    int levels;                 //highest level currently in use
+    int head[SKIPLEVELS];       //first slot on each level, -1 if none
+    int (*next)[SKIPLEVELS];    //per slot: next slot on each level, -1 if none
+} nameIndex;
+
+typedef struct sTable {
+    sObject *objects;
+    FRAME *replies;             //per slot: the encoded get reply, ready to write
+    char *replyValid;           //1 if the slot's replies match its object
+    char *used;                 //1 if the slot holds an object
+    int *freeSlots;             //stack of unused slot numbers
+    int nFree;
+    int size;
+    int count;
+    int lastVersion;            //last version handed out; never reused, even after a delete
+    nameIndex index;
+
+    //cache mode: a byte budget with CLOCK eviction
+    long budget;                //max resident bytes; 0 for no budget (plain table)
+    long residentBytes;         //object name + data bytes currently held
+    char *refBit;               //per slot: set on get, cleared as the clock hand passes
+    int clockHand;
+    long hits, misses, evictions;
+    coldStore *cold;            //where evicted objects go (-D), or NULL to drop them
+} sTable;
+
+//a read lease held by a client, or an object a caching client holds
+typedef struct leaseEntry {
+    char name[MAXWORD];         //empty if the entry is unused
+    long until;                 //CLOCK_MONOTONIC ms when the lease runs out
+} leaseEntry;
+
+typedef struct cacheEntry {
+    sObject obj;                //obj.name empty if the entry is unused
+    long until;
+} cacheEntry;
+
+//io_uring backend: the rings shared with the kernel, and for each client its
+//provided buffers, the ones filled by its multishot read, and what it has in flight
+typedef enum URINGOP {ur_read = 1, ur_write, ur_pollout} URINGOP;
+
+typedef struct uringBuf {
+    int bid;                    //buffer id within the client's group
+    int len;                    //bytes read into it
+    int off;                    //bytes already moved to the read-ahead queue
+} uringBuf;
+
+typedef struct uringLoop {
+    int fd;
+    int sqpoll;
+    unsigned sqEntries;
+    unsigned *sqHead, *sqTail, *sqMask, *sqFlags, *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    int toSubmit;               //sqes queued since the last io_uring_enter
+
+    struct io_uring_buf_ring *bufRing[NCLIENT];
+    unsigned short bufTail[NCLIENT];
+    char *bufs;                 //NCLIENT * URINGBUFS buffers of URINGBUFLEN bytes
+    uringBuf filled[NCLIENT][URINGBUFS];
+    int nFilled[NCLIENT];
+    int reading[NCLIENT];       //multishot read armed
+    int writing[NCLIENT];       //reply writev in flight
+    int waitingOut[NCLIENT];    //fifo was full: POLLOUT armed
+    struct iovec iov[NCLIENT][2];
+    size_t writeLen[NCLIENT];
+
+    long enters, submitted, completed, reads, readBytes, writes;
+} uringLoop;
+
+//capture file: a header, then per request a record and the first len bytes of
+//its frame (the rest are zero); a frame's deadline is stored as the ms it had left
+typedef struct captureHeader {
+    char magic[8];              //CAPTUREMAGIC
+    int frameSize;              //sizeof(FRAME) of the build that wrote it
+    int pad;
+} captureHeader;
+
+typedef struct captureRecord {
+    uint32_t gapUs;             //since the record before (since the capture opened, for the first)
+    uint16_t len;
+    uint8_t client;             //client id
+    uint8_t pad;
+} captureRecord;
+
+//one server a client talks to; object names are spread over them by jump hash
+typedef struct shardLink {
+    const char *dir;            //where its fifos are
+    int cliFD;                  //fifo-id-0: requests to the server
+    int servFD;                 //fifo-0-id: replies from it
+    FRAME pending[MAXPIPE];     //requests sent whose replies haven't been read (a ring, oldest first)
+    long sentAt[MAXPIPE];       //monotonicMs() each was sent, for lease expiry
+    int tries[MAXPIPE];         //times each was retried
+    int head;
+    int n;
+    FRAME held;                 //a reply read early: its request was answered out of turn
+    int hasHeld;
+} shardLink;
+
+//a client's request deadlines and retries, and what became of them
+typedef struct callPolicy {
+    int timeoutMs;              //-D: deadline after sending; 0 waits forever
+    int retries;                //-r
+    int lastSeq;                //sequence number of the last request sent
+    long sent;
+    long timedOut;
+    long retried;
+    long failed;                //given up
+    long stale;                 //replies dropped because their request had been given up or retried
+} callPolicy;
+callPolicy clientCalls = {.retries = RETRIES};
+
+//frames waiting for room in a fifo or socket (a ring)
+typedef struct frameQueue {
+    FRAME *frames;
+    int size;
+    int head;                   //oldest queued frame
+    int n;
+    size_t sent;                //bytes of the oldest frame already written
+    int peak;                   //most frames ever queued
+} frameQueue;
+
+//server-side state for one client id
+typedef struct cliState {
+    int id;
+    int inFD;                   //fifo-id-0: requests from the client
+    int outFD;                  //fifo-0-id: replies and notifications to the client
+    int nWatch;
+    char watch[MAXWATCH][MAXWORD];  //watched name prefixes
+    FRAME notifyQ[WATCHQUEUE];  //notify frames not yet written; the last may still be filling
+    int nNotify;
+    int dropped;                //events dropped while notifyQ was full
+    int leaseMs;                //lease length granted on each get; 0 if the client doesn't cache
+    leaseEntry leases[LEASESLOTS];
+
+    //replies not yet written to outFD; room past REPLYHIGHWATER holds one
+    //request's replies plus an inval for every lease the client can hold
+    FRAME replyBuffer[REPLYQUEUE];
+    frameQueue replies;
+    long paused;                //times reading requests stopped at the high-water mark
+    int seq;                    //the request being served; its replies carry this
+    int noReply;                //the request being served asked for no reply
+    long silent;                //writes applied without a reply (FR_NOREPLY)
+    long silentFailed;          //those that failed, which nobody heard about
+
+    //requests read but not yet served (a ring), and when each was read
+    FRAME inQ[INQUEUE];
+    long inAt[INQUEUE];         //monotonicUs()
+    int inHead;
+    int nIn;
+    FRAME inPart;               //a request whose read stopped partway, so far
+    size_t inPartHave;          //bytes of it
+    double weight;              //share of service when clients compete
+    double vtime;               //virtual time at which its next request may start
+} cliState;
+
+//one end of a replication link: a primary has one per replica, a replica
+//one to its primary. Changes flow down, acks of the last change applied up.
+typedef struct replLink {
+    int fd;                     //-1 while not connected
+    frameQueue out;             //frames not yet written
+    char in[REPLREAD * sizeof(FRAME)];  //bytes read but not yet a whole frame
+    size_t inHave;
+    int synced;                 //primary: the replica has been sent its catch-up
+    int next;                   //primary: next change to queue for the replica, from the log
+    int applied;                //primary: last change the replica says it has applied
+} replLink;
+
+typedef struct serverState {
+    sTable table;
+    time_t startTime;
+    int maxLeaseMs;
+    cliState clients[NCLIENT];
+    struct pollfd pollFDs[NPOLL];
+    uringLoop *uring;           //io_uring backend (-E), or NULL for poll
+    long spinMaxUs;             //busy-poll budget cap (-B); 0 always sleeps
+    long spinUs;                //current budget, adapted to recent arrivals
+    long spins;                 //waits that spun first
+    long spinHits;              //of those, ones that found work before sleeping
+    long spunUs;                //time spent spinning
+    long sleeps;                //waits that slept
+    long sleepShort;            //of those, woken within spinMaxUs (a longer spin would have done)
+    int hasQuit;
+    long requests;              //requests served since start
+
+    //fair scheduling of read-ahead requests across clients
+    double vtime;               //start tag of the request served last
+    long served[NPRIO];         //requests served in each class
+    long waitUs[NPRIO];         //total time they waited after being read
+    long maxWaitUs[NPRIO];
+    long expired[NPRIO];        //dropped because their deadline had passed
+
+    //telemetry: periodic samples of the server's own resource use
+    int telemetryMs;            //sample period; 0 for no telemetry
+    long nextSample;            //monotonicMs() of the next sample
+    long startMs;               //monotonicMs() at start
+    FILE *telemetry;            //CSV, one row per sample
+    int statmFD;                ///proc/self/statm, kept open for current RSS
+
+    //capture of every request received (-C)
+    FILE *capture;
+    long captureUs;             //monotonicUs() of the last record
+    long captured;              //records written
+    long captureBytes;
+
+    int pipeSize;               //bytes asked for each fifo; 0 leaves the system default
+    const char *fifoDir;        //where the client fifos live
+
+    //replication: a primary numbers its changes (puts and deletes) and streams
+    //them to its replicas, which apply them and serve reads
+    const char *replPath;       //unix socket the primary listens on
+    int replica;                //1 if this server is a read-only replica
+    int listenFD;               //primary: socket replicas connect to; -1 if none
+    replLink replicas[MAXREPLICA];  //primary: one per connected replica
+    replLink primary;           //replica: the link to the primary
+    FRAME *replLog;             //primary: the last REPLLOG changes; change seq at (seq - 1) % REPLLOG
+    int replSeq;                //primary: changes made; replica: changes applied
+    int epoch;                  //the primary run replSeq counts in (its pid)
+    int inSnapshot;             //replica: a snapshot is arriving
+    long lastHeard;             //replica: monotonicMs() of the primary's last position frame
+    long nextBeat;              //monotonicMs() of the next position frames, or reconnect attempt
+} serverState;
+
+//the signal (SIGINT or SIGTERM) that asked the server to shut down; 0 until one comes
+volatile sig_atomic_t serverStopSignal = 0;
+
+//text report sent back for a stats request
+typedef struct statsReport {
+    int n;
+    char lines[MAXSTATLINES][MAXLINELENGTH];
+} statsReport;
+
+//functions for the server object table
+int tableInit(sTable *table, int size);
+void tableFree(sTable *table);
+int tableFind(sTable *table, const char *name);
+int tablePut(sTable *table, sObject *obj);
+int tableDelete(sTable *table, const char *name);
+int tableSeek(sTable *table, const char *key, int after);
+int tableNext(sTable *table, int slot);
+int tableSet(sTable *table, sObject *obj, int expected);
+int tableRemove(sTable *table, const char *name, int expected);
+int versionCheck(int expected);
+int tableApply(sTable *table, sObject *obj);
+int tableFault(sTable *table, const char *name);
+int coldOpen(coldStore *cold, const char *dir);
+void coldClose(coldStore *cold);
+coldEntry *coldFind(coldStore *cold, const char *name);
+int coldSpill(coldStore *cold, sObject *obj);
+int coldRead(coldStore *cold, coldEntry *entry, sObject *obj);
+void coldDrop(coldStore *cold, const char *name);
+int coldRange(coldStore *cold, listMsg *req, char (**names)[MAXWORD]);
+void coldCompact(coldStore *cold, int steps);
+void coldStats(coldStore *cold, statsReport *report);
+int serverGet(cliState *cli, sTable *table, const char *name);
+long objectBytes(sObject *obj);
+int tableEvict(sTable *table, long needBytes, int keepSlot);
+void statsLine(statsReport *report, const char *format, ...);
+void tableStats(sTable *table, statsReport *report);
+int serverStats(cliState *cli, statsReport *report);
+int serverOpenClient(cliState *cli, int id, const char *dir, int pipeSize);
+int queuePush(frameQueue *queue, FRAME *frames, int n);
+int serverReply(cliState *cli, FRAME *frames, int n);
+int queueWrite(frameQueue *queue, int fd);
+int queueSpan(frameQueue *queue, struct iovec pieces[2]);
+void queueAdvance(frameQueue *queue, size_t nwrote);
+int uringOpen(uringLoop *ring, int sqpoll);
+struct io_uring_sqe *uringSqe(uringLoop *ring);
+void uringQueue(uringLoop *ring);
+unsigned uringWakeup(uringLoop *ring);
+void uringRecycle(uringLoop *ring, int c, int bid);
+void uringFeed(serverState *srv, int c);
+void uringReap(serverState *srv);
+int uringWait(serverState *srv, int waitMs);
+int serverPoll(serverState *srv, int waitMs);
+int serverWait(serverState *srv, int waitMs);
+void spinStats(serverState *srv, statsReport *report);
+void uringWrite(uringLoop *ring, cliState *cli, int c);
+void uringSettle(serverState *srv, int c);
+void uringStats(serverState *srv, statsReport *report);
+void replyStats(serverState *srv, statsReport *report);
+void serverRequest(serverState *srv, cliState *cli, FRAME *frame);
+PRIO framePrio(KIND kind);
+int serverReadAhead(serverState *srv, cliState *cli);
+size_t serverTake(serverState *srv, cliState *cli, const char *bytes, size_t len);
+void serverEnqueue(serverState *srv, cliState *cli, FRAME *frames, int n);
+int captureOpen(serverState *srv, const char *path);
+void captureFrame(serverState *srv, cliState *cli, FRAME *frame, long nowUs);
+int runReplay(const char *path, const char *dir, double scale, int depth);
+int replayCompare(const void *a, const void *b);
+cliState *schedNext(serverState *srv);
+void schedServe(serverState *srv);
+void schedStats(serverState *srv, statsReport *report);
+int watchAdd(cliState *cli, const char *prefix);
+int watchRemove(cliState *cli, const char *prefix);
+void watchPublish(serverState *srv, KIND op, const char *name, int version);
+void watchFlush(cliState *cli);
+void sendRequest(int fd, FRAME *frame);
+void callStamp(FRAME *frame);
+int callRetry(FRAME *request, int tries);
+int shardRecv(shardLink *shard, int seq, long deadline, FRAME *frame);
+int shardCall(shardLink *shard, FRAME *request, FRAME *reply);
+void shardIssue(shardLink *shard, FRAME *frame, int tries);
+void shardQuiet(shardLink *shard, FRAME *frame);
+void clientWait(shardLink *shards, int nShards, int millisec);
+int shardOf(const char *name, int nShards);
+void shardSend(shardLink *shard, FRAME *frame, int depth, int leaseMs);
+void shardReply(shardLink *shard, int leaseMs);
+void shardsFinish(shardLink *shards, int nShards, int leaseMs);
+long monotonicMs(void);
+long monotonicUs(void);
+unsigned int nameHash(const char *name);
+void leaseGrant(cliState *cli, const char *name);
+void leaseRevoke(serverState *srv, const char *name, int version);
+cacheEntry *cacheLookup(const char *name);
+void cacheStore(sObject *obj, long until);
+void cacheDrop(const char *name);
+void clientDrain(int fd);
+long benchNow(void);
+void benchReport(FILE *out, const char *name, long iters, long elapsedNs);
+int runBench(const char *outPath);
+int telemetryOpen(serverState *srv, const char *path);
+void telemetrySample(serverState *srv);
+void serverStop(int sig);
+int replListen(serverState *srv);
+int replConnect(serverState *srv);
+void replAccept(serverState *srv);
+void replCatchUp(serverState *srv, replLink *link, int epoch, int seq);
+void replPublish(serverState *srv, KIND op, sObject *obj);
+int replFeed(serverState *srv, replLink *link);
+void replApply(serverState *srv, FRAME *frame);
+void replBeat(serverState *srv);
+void replEvents(serverState *srv);
+void replStats(serverState *srv, statsReport *report);
+FRAME replFrame(KIND step, int epoch, int seq);
+int linkRead(replLink *link, FRAME *frames, int max);
+void linkClose(replLink *link);
+int serverList(cliState *cli, sTable *table, listMsg *req);
 
 //functions for all client/server communications
 int clientRequestID(int fdC, int fdS);
@@ -114,12 +738,13 @@ int Tokenizer(char inputStr[], char tokens[][MAXWORD], char seps[], char* pointe
 DATA packIntM(int clientID, KIND kind, int argument);
 DATA packStrM(const char *a, const char *b, const char *c);
 DATA packData(int ID, char name[], strMsg package);
+DATA packListM(int prefix, const char *low, const char *high, const char *cursor);
 void printFrame(const char *userPrefix, FRAME *frame);
 void printObjectPacket(sObject obj);
 FRAME receiveFrame(int fileDesc);
 void sendFrame(int fileDesc, KIND kind, DATA *data);
 KIND getFrameKind(char command[]);
-int serverACK(int clientFD, KIND frameKind, int dataType);
+int serverACK(cliState *cli, KIND frameKind, int result);
 FRAME initFrame();
 
 //
@@ -138,11 +763,42 @@ int main(int argc, char* argv[]){
     userFlag[2] = '\0';                         //replace newline with null-terminator
     char serverFlag[] = {'-','s', '\0'};        //set up server flag comparison string
     char clientFlag[] = {'-', 'c', '\0'};       //       client flag comp. str.
+    char benchFlag[] = {'-', 'b', '\0'};        //       bench flag comp. str.
+    char replayFlag[] = {'-', 'y', '\0'};       //       replay flag comp. str.
+
+    // ====================================================================================================
+    //  Run the microbenchmarks
+    // ====================================================================================================
+    if (strcmp(userFlag, benchFlag) == 0){
+        return runBench((argc > 2) ? argv[2] : "bench.csv");
+    }
 
-    //setup FIFOS:
-    //single-server; single-client mode;
-    char fifoStoC[] = "./fifo-0-1";
-    char fifoCtoS[] = "./fifo-1-0";
+    // ====================================================================================================
+    //  Replay a capture
+    // ====================================================================================================
+    if (strcmp(userFlag, replayFlag) == 0){
+        const char *dir = ".";
+        double scale = 1;
+        int depth = REPLAYDEPTH;
+        int opt;
+        int badUsage = (argc <= 2);
+        optind = 3;
+        while (!badUsage && (opt = getopt(argc, argv, "d:S:P:")) != -1){
+            switch (opt){
+                case 'd': dir = optarg; break;
+                case 'S': scale = strtod(optarg, NULL); break;
+                case 'P': depth = strtol(optarg, NULL, 10); break;
+                default: badUsage = 1;
+            }
+        }
+        if (badUsage){
+            printf("usage: %s -y capture [-d dir] [-S scale] [-P depth]\n", argv[0]);
+            return 1;
+        }
+        if (depth < 1) depth = 1;
+        if (depth > MAXPIPE) depth = MAXPIPE;
+        return runReplay(argv[2], dir, scale, depth);
+    }
 
     // ====================================================================================================
     //  Run in Server Mode
@@ -151,227 +807,245 @@ int main(int argc, char* argv[]){
 
         #define STAG "*[S]: "
 
+        serverState server;
+        memset(&server, 0, sizeof(server));
+
         //setup a timer since server start.
-        time_t startTime = time(NULL);
+        server.startTime = time(NULL);
 
-        int hasQuit = 0;
-        int idNumber = 0;
+        //server options
+        int tableSize = NOBJECT;
+        long memBudget = 0;
+        server.maxLeaseMs = MAXLEASE;
+        const char *telemetryPath = TELEMETRYFILE;
+        server.fifoDir = ".";
+        server.listenFD = -1;
+        server.primary.fd = -1;
+        for (int r = 0; r < MAXREPLICA; r++) server.replicas[r].fd = -1;
+        int opt;
+        optind = 2;
+        char *weights = NULL;
+        const char *backend = "poll";
+        const char *capturePath = NULL;
+        const char *coldDir = NULL;
+        while ((opt = getopt(argc, argv, "n:m:l:t:T:p:d:R:r:w:E:C:B:o:")) != -1){
+            switch (opt){
+                case 'n': tableSize = strtol(optarg, NULL, 10); break;
+                case 'm': memBudget = strtol(optarg, NULL, 10); break;
+                case 'l': server.maxLeaseMs = strtol(optarg, NULL, 10); break;
+                case 't': server.telemetryMs = strtol(optarg, NULL, 10); break;
+                case 'T': telemetryPath = optarg; break;
+                case 'p': server.pipeSize = strtol(optarg, NULL, 10); break;
+                case 'd': server.fifoDir = optarg; break;
+                case 'R': server.replPath = optarg; server.replica = 0; break;
+                case 'r': server.replPath = optarg; server.replica = 1; break;
+                case 'w': weights = optarg; break;
+                case 'E': backend = optarg; break;
+                case 'C': capturePath = optarg; break;
+                case 'B': server.spinMaxUs = strtol(optarg, NULL, 10); break;
+                case 'o': coldDir = optarg; break;
+                default:
+                    printf(STAG "usage: %s -s [-n objects] [-m bytes] [-l ms] [-t ms] [-T file] [-p bytes] [-d dir] [-R socket | -r socket] [-w weights] [-E poll|uring|sqpoll] [-C file] [-B us] [-o dir]\n", argv[0]);
+                    exit(EXIT_FAILURE);
+            }
+        }
+        if (tableSize <= 0) tableSize = NOBJECT;
 
         //create object table:
-        sObject objectTable[NOBJECT];
-        for(int i = 0; i < NOBJECT; i++) memset(&objectTable[i], 0, sizeof(sObject));
-        int objectTableCapacity = 0;
-
-        //open FIFO pipes:
-        int cliFD = open(fifoCtoS, O_RDWR);     //client pipe in non-blocking mode
-        if (cliFD == -1){
-            printf(STAG "Error opening [%s]: %s.\n", fifoCtoS, strerror(errno));
-        } else printf(STAG "open c|s fifo %s, %d\n", fifoCtoS, cliFD);
-
-        int servFD = open(fifoStoC, O_RDWR);    //server pipe in non-blocking mode
-        if (servFD < 0){
-            printf(STAG "Error opening [%s]: %s.\n", fifoStoC, strerror(errno));
-        } else printf(STAG "open s|c fifo %s, %d\n", fifoStoC, servFD);
-
-
-		//manage clients (for a2p3);
-		int clientList[3];
-			memset(&clientList, 0, sizeof(clientList));
-
-        /*
-        nfds_t servFDNum = 1;
-        struct pollfd servFDs[1];
-        servFDs[0].fd = servFD;
-        servFDs[0].events = POLLOUT; //is server fifo ready for writing? blocks, if not.
-        */
-
-        struct pollfd cliFDs[3];
-        nfds_t cliFDNum = 3;
-        cliFDs[0].fd = cliFD;
-        cliFDs[0].events = POLLIN; //does any client fifo have data inside?
-        
-        //time to poll fifos
-        int ttl = 2500;
-
-        while (!hasQuit){
+        if (tableInit(&server.table, tableSize) < 0){
+            printf(STAG "Error creating object table: %s.\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        server.table.budget = memBudget;
+        if (memBudget > 0) printf(STAG "cache mode: [%ld] byte budget, [%d] slots.\n", memBudget, tableSize);
 
-            //reset poll structs?
-            /*
-            for (int i = 0; i < servFDNum; i++){
-                servFDs[i].events = POLLOUT;
-                servFDs[i].revents = 0;
-            }
-            for (int i = 0; i < cliFDNum; i++){
-                cliFDs[i].events = POLLIN;
-                cliFDs[i].revents = 0;
+        //the cold tier sits under the table; replicas would need it shipped too
+        coldStore cold;
+        if (coldDir != NULL){
+            if (server.replPath != NULL){
+                printf(STAG "the cold tier isn't replicated; not with -R or -r.\n");
+                exit(EXIT_FAILURE);
             }
-            */
+            if (coldOpen(&cold, coldDir) < 0) exit(EXIT_FAILURE);
+            server.table.cold = &cold;
+            printf(STAG "cold tier: segments of [%d] bytes in [%s].\n", SEGMENTBYTES, coldDir);
+        }
 
-            //printf("Polling client fds for %d.%d sec.\n", ttl/1000, ttl%1000);
-            int cretval = 0;
-            cretval = poll(cliFDs, cliFDNum, ttl);
-            
-            if(cretval > 0){
-                //got some data, which fds have things?
-                for (int i = 0; i < cliFDNum; i++){
-                    if (cliFDs[i].revents != 0){
-                        printf(STAG "fd %d with event %d.\n", cliFDs[i].fd, cliFDs[i].revents);
-                        //writer has POLLHUP; reopen the fd.
-                        //stops repeated data reads on fd's that keep reporting POLLHUP???
-                        if (cliFDs[i].revents == 16){
-                            close(cliFDs[i].fd);
-                            open(fifoCtoS, O_RDWR);
-                            break;
-                        }
+        //open FIFO pipes, one pair per client id;
+        //pollFDs[0..NCLIENT-1] watch the client-to-server ends for requests,
+        //pollFDs[NCLIENT..] the server-to-client ends while replies are waiting.
+        for (int c = 0; c < NCLIENT; c++){
+            if (serverOpenClient(&server.clients[c], c + 1, server.fifoDir, server.pipeSize) < 0) exit(EXIT_FAILURE);
+            server.pollFDs[c].fd = server.clients[c].inFD;
+            server.pollFDs[c].events = POLLIN;
+            server.pollFDs[NCLIENT + c].fd = server.clients[c].outFD;
+            server.clients[c].weight = 1;
+        }
+        char *weight = (weights != NULL) ? strtok(weights, ",") : NULL;
+        for (int c = 0; c < NCLIENT && weight != NULL; c++, weight = strtok(NULL, ",")){
+            if (strtod(weight, NULL) > 0) server.clients[c].weight = strtod(weight, NULL);
+        }
 
-                        FRAME newFrame = initFrame();
-                        newFrame = receiveFrame(cliFDs[i].fd);
-                        printFrame(STAG "got client data from fd", &newFrame);
-
-                        //send ack:
-                        DATA ackData;
-                        memset(&ackData, 0, sizeof(DATA));
-                        ackData = packIntM(newFrame.data.TYPE, newFrame.kind, 0);
-                        serverACK(servFD, newFrame.kind, 0);
-
-                        //process client req's:
-                        sObject cliObj;
-                        memset(&cliObj, 0, sizeof(cliObj));
-
-                        sObject servObj;
-                        memset(&servObj, 0, sizeof(servObj));
-
-                        // =======================================================================
-                        // SERVER RESPONSES TO CLIENT REQUESTS
-                        // =======================================================================
-                        switch(newFrame.kind){
-
-                            //
-                            // PUT
-                            //
-                            case (put):;
-                                cliObj = newFrame.data.package.mObj;
-                                int objSlot;
-                                
-                                //check if table is full.
-                                if(objectTableCapacity < NOBJECT){
-                                    //table has space, check for entries
-                                    for(int j = 0; j < NOBJECT; j++){
-                                        if (strncmp(objectTable[j].name, cliObj.name, sizeof(objectTable[j].name)) == 0){
-                                            printf(STAG "PUT error: item already exists. [%s]\n", cliObj.name);
-                                            break;
-                                        }
-                                        //didn't find anything;
-                                    }
-                                }
-                                else{
-                                    printf(STAG "PUT error: server table capacity maxed [%d].\n", NOBJECT);
-                                    break;
-                                }
+        //replication links are polled from REPLPOLL on; a replica that can't
+        //reach its primary yet serves an empty table and keeps trying
+        for (int i = REPLPOLL; i < NPOLL; i++) server.pollFDs[i].fd = -1;
+        if (server.replPath != NULL){
+            signal(SIGPIPE, SIG_IGN);
+            if (server.replica) replConnect(&server);
+            else if (replListen(&server) < 0) exit(EXIT_FAILURE);
+            server.nextBeat = monotonicMs() + (server.replica ? REPLRETRY : REPLBEAT);
+        }
 
-                                //check if table has an empty space.
-                                sObject emptyObj;
-                                memset(&emptyObj, 0, sizeof(sObject));
+        //io_uring takes over the client fifos; replication links are only polled
+        uringLoop uring;
+        if (strcmp(backend, "poll") != 0){
+            if (strcmp(backend, "uring") != 0 && strcmp(backend, "sqpoll") != 0){
+                printf(STAG "unknown backend [%s]: poll, uring or sqpoll.\n", backend);
+                exit(EXIT_FAILURE);
+            }
+            if (server.replPath != NULL){
+                printf(STAG "the %s backend doesn't carry replication; use poll with -R or -r.\n", backend);
+                exit(EXIT_FAILURE);
+            }
+            if (uringOpen(&uring, strcmp(backend, "sqpoll") == 0) < 0){
+                printf(STAG "io_uring unavailable: %s.\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            server.uring = &uring;
+            printf(STAG "%s backend: [%u] entries, [%d] x [%zu] byte read buffers per client.\n", backend, uring.sqEntries, URINGBUFS, URINGBUFLEN);
+        }
 
-                                int index = -1;
-                                for(int k = 0; k < NOBJECT; k++){
-                                    if (memcmp(&emptyObj, &objectTable[k], sizeof(sObject)) == 0){
-                                        index = k;
-                                        // all good, copy data:
-                                        objectTable[index] = cliObj;
-                                        objectTableCapacity +=1;
+        if (capturePath != NULL && captureOpen(&server, capturePath) < 0) exit(EXIT_FAILURE);
 
-                                        printf(STAG "PUT at loc [%d]:\n\
-NAME: \t[%s]\n\
-OWNR: \t[%d]\n\
-LOAD: [%s], [%s], [%s]\n",
-                                index,
-                                &objectTable[index].name[0],
-                                &objectTable[index].owner,
-                                &objectTable[index].package.data1,
-                                &objectTable[index].package.data2,
-                                &objectTable[index].package.data3);
-                                        break;
-                                    }
-                                
-                                }
-                                
+        //the first sample is taken before any requests, as a baseline
+        server.startMs = monotonicMs();
+        if (server.telemetryMs > 0){
+            if (telemetryOpen(&server, telemetryPath) < 0) exit(EXIT_FAILURE);
+            telemetrySample(&server);
+        }
 
-                                break;
+        //SIGINT and SIGTERM end the loop below (interrupting its wait), so the
+        //last telemetry sample, the capture, the replication socket and the
+        //cold tier are put away
+        struct sigaction stopAction;
+        memset(&stopAction, 0, sizeof(stopAction));
+        stopAction.sa_handler = serverStop;
+        sigemptyset(&stopAction.sa_mask);
+        sigaction(SIGINT, &stopAction, NULL);
+        sigaction(SIGTERM, &stopAction, NULL);
 
-                            //
-                            // GET
-                            //
-                            case (get):;
-                                cliObj = newFrame.data.package.mObj;
-                                for (int g = 0; g < objectTableCapacity; g++){
-                                    //search for named obj in table:
-                                    if (strncmp(objectTable[g].name, cliObj.name, sizeof(objectTable[g].name)) == 0){ 
-                                        DATA foundData = packData(cliObj.owner, cliObj.name, cliObj.package);
-                                        sendFrame(servFD, get, &foundData);
-                                        break;
-                                    }
-                                }
-                                //didn't find obj in table;
-                                printf(STAG "GET error: object [%s] not found in server table.\n", cliObj.name);
-                                break;
+        //time to poll fifos
+        int ttl = 2500;
 
-                            //
-                            // DELETE
-                            //
-                            case (delete):;
-                                cliObj = newFrame.data.package.mObj;
-                                for (int d = 0; d < objectTableCapacity; d++){
-                                    if (strncmp(objectTable[d].name, cliObj.name, sizeof(objectTable[d].name)) == 0){
-                                        printf(STAG "deleting [%d]:[%s] from table; this is final!\n", d, cliObj.name);
-                                        memset(&objectTable[d], 0, sizeof(sObject));
-                                        objectTableCapacity -=1;
-                                    }
-                                }
-                                //didn't find obj in table;
-                                printf(STAG "DELETE error: [%s] not found in table. Could not delete.\n", cliObj.name);
-                                break;
+        while (!server.hasQuit){
 
-                            //
-                            // GTIME
-                            //
-                            case (gtime):;
-                                DATA timeData;
-                                memset(&timeData, 0, sizeof(timeData));
-                                time_t currTime = time(NULL);
-                                time_t elapsed = currTime - startTime;
-                                timeData = packIntM(0, 0, elapsed);
-                                sendFrame(servFD, stime, &timeData);
-                                printf(STAG "send elapsed time [%d sec.]\n", elapsed);
-                                break;
-                            
-                            //
-                            // DELAY
-                            //
-                            case (delay):;
+            //a client whose replies are backing up isn't read (or served) until it catches up,
+            //nor is one with a full read-ahead queue
+            for (int c = 0; c < NCLIENT; c++){
+                cliState *cli = &server.clients[c];
+                int full = (cli->replies.n >= REPLYHIGHWATER);
+                if (full && server.pollFDs[c].events != 0){
+                    cli->paused++;
+                    printf(STAG "client [%d] has [%d] replies waiting; not reading it until they drain.\n", cli->id, cli->replies.n);
+                }
+                server.pollFDs[c].events = (full || cli->nIn == INQUEUE) ? 0 : POLLIN;
+                server.pollFDs[NCLIENT + c].events = (cli->replies.n > 0) ? POLLOUT : 0;
+            }
+            if (server.replPath != NULL){
+                replLink *up = &server.primary;
+                server.pollFDs[REPLPOLL].fd = server.replica ? up->fd : server.listenFD;
+                server.pollFDs[REPLPOLL].events = POLLIN | ((server.replica && up->out.n > 0) ? POLLOUT : 0);
+                for (int r = 0; r < MAXREPLICA; r++){
+                    replLink *link = &server.replicas[r];
+                    server.pollFDs[REPLPOLL + 1 + r].fd = link->fd;
+                    server.pollFDs[REPLPOLL + 1 + r].events = POLLIN | ((link->out.n > 0) ? POLLOUT : 0);
+                }
+            }
 
-                                break;
-                            
-                            //
-                            // QUIT
-                            //
-                            case (quit):;
-                                printf(STAG "client quit!");
-                                break;
+            //wake up for the next telemetry sample or replication beat if it comes before the poll timeout;
+            //don't wait at all while read-ahead requests can be served
+            int waitMs = ttl;
+            for (int c = 0; c < NCLIENT; c++){
+                if (server.clients[c].nIn > 0 && server.clients[c].replies.n < REPLYHIGHWATER) waitMs = 0;
+            }
+            if (server.table.cold != NULL && server.table.cold->compacting >= 0) waitMs = 0;
+            if (server.telemetryMs > 0){
+                long untilSample = server.nextSample - monotonicMs();
+                if (untilSample < waitMs) waitMs = (untilSample > 0) ? untilSample : 0;
+            }
+            if (server.replPath != NULL){
+                long untilBeat = server.nextBeat - monotonicMs();
+                if (untilBeat < waitMs) waitMs = (untilBeat > 0) ? untilBeat : 0;
+            }
 
-                            default:
-                                break;
-                        } // end of switch cases for server responses;
+            //printf("Polling client fds for %d.%d sec.\n", ttl/1000, ttl%1000);
+            //a stop that came while serving isn't waited out
+            if (serverStopSignal != 0) waitMs = 0;
+            int cretval = serverWait(&server, waitMs);
+            if (serverStopSignal != 0){
+                printf(STAG "signal [%d]: shutting down.\n", (int)serverStopSignal);
+                server.hasQuit = 1;
+                break;
+            }
+            
+            if(cretval > 0){
+                //got some data, which fds have things? queue their requests
+                for (int i = 0; i < NCLIENT; i++){
+                    if (server.pollFDs[i].revents & POLLIN){
+                        printf(STAG "fd %d with event %d.\n", server.pollFDs[i].fd, server.pollFDs[i].revents);
+                        serverReadAhead(&server, &server.clients[i]);
                     } // end of if statement for a POLLIN event;
                 } // end of for loop of client descriptors
+                if (server.replPath != NULL) replEvents(&server);
             } //end of if statement for cretval/poll
-            else if (cretval == 0){
+            else if (cretval == 0 && waitMs == ttl){
                 printf("*[S]: Poll timeout.\n");
             }
-            else if (cretval < 0){
+            else if (cretval < 0 && errno != EINTR){
                 printf("*[S]: Poll error: %s.\n", strerror(errno));
             }
+            //a quiet moment (waited, and nothing came): put the capture on disk
+            if (cretval == 0 && waitMs > 0 && server.capture != NULL) fflush(server.capture);
+
+            //serve queued requests, most deserving client first
+            schedServe(&server);
+
+            //queue whatever notifications this round produced, then write each client
+            //as many of its replies as its fifo has room for, in one write
+            for (int c = 0; c < NCLIENT; c++){
+                watchFlush(&server.clients[c]);
+                if (server.uring != NULL) uringWrite(server.uring, &server.clients[c], c);
+                else queueWrite(&server.clients[c].replies, server.clients[c].outFD);
+            }
+
+            //then send the round's changes (or acks) down each replication link
+            if (server.replPath != NULL){
+                if (monotonicMs() >= server.nextBeat) replBeat(&server);
+                for (int r = 0; r < MAXREPLICA; r++){
+                    replLink *link = &server.replicas[r];
+                    if (link->fd < 0 || (link->synced && replFeed(&server, link) < 0)) continue;
+                    if (queueWrite(&link->out, link->fd) < 0) linkClose(link);
+                }
+                if (server.primary.fd >= 0 && queueWrite(&server.primary.out, server.primary.fd) < 0) linkClose(&server.primary);
+            }
+
+            //a little of the cold tier's compaction each round
+            if (server.table.cold != NULL) coldCompact(server.table.cold, COMPACTSTEP);
+
+            if (server.telemetryMs > 0 && monotonicMs() >= server.nextSample) telemetrySample(&server);
         } // end while loop
+        if (server.listenFD >= 0){
+            close(server.listenFD);
+            unlink(server.replPath);
+        }
+        if (server.telemetryMs > 0){
+            telemetrySample(&server);
+            fclose(server.telemetry);
+            close(server.statmFD);
+        }
+        if (server.capture != NULL) fclose(server.capture);
+        if (server.table.cold != NULL) coldClose(server.table.cold);
+        tableFree(&server.table);
     }  // END SERVER MODE if-statement ====================================================================
 
 
@@ -381,15 +1055,78 @@ LOAD: [%s], [%s], [%s]\n",
     // ====================================================================================================
     else if ((strcmp(userFlag, clientFlag) == 0)){
         #define CTAG "*[C]: "
-        //set up the FIFO pipes
-        int cliFD = open(fifoCtoS, O_RDWR);     //write to pipe: client-to-server
-            if (cliFD < 0){
-                printf(CTAG "open c|s fd [%s] failed.\n", fifoCtoS);
-            } else printf(CTAG "open c|s fd [%d]\n", cliFD);
-        int servFD = open(fifoStoC, O_RDWR);    //read from server pipe
-            if (servFD < 0){
-                printf(CTAG "open s|c fd [%s] failed.\n", fifoStoC);
-            } else printf(CTAG "open s|c fd [%d]\n", servFD);
+        //client options
+        int leaseMs = 0;
+        int depth = 1;
+        int noReply = 0;
+        shardLink shards[MAXSHARD];
+        memset(shards, 0, sizeof(shards));
+        shards[0].dir = ".";
+        int nShards = 1;
+        int opt;
+        optind = 3;
+        while ((opt = getopt(argc, argv, "L:d:P:D:a:N")) != -1){
+            switch (opt){
+                case 'L': leaseMs = strtol(optarg, NULL, 10); break;
+                case 'd':
+                    nShards = 0;
+                    for (char *dir = strtok(optarg, ","); dir != NULL && nShards < MAXSHARD; dir = strtok(NULL, ",")){
+                        shards[nShards++].dir = dir;
+                    }
+                    break;
+                case 'P': depth = strtol(optarg, NULL, 10); break;
+                case 'D': clientCalls.timeoutMs = strtol(optarg, NULL, 10); break;
+                case 'a': clientCalls.retries = strtol(optarg, NULL, 10); break;
+                case 'N': noReply = 1; break;
+                default:
+                    printf(CTAG "usage: %s -c file [-L ms] [-d dir[,dir...]] [-P depth] [-D ms] [-a retries] [-N] [idNumber]\n", argv[0]);
+                    exit(EXIT_FAILURE);
+            }
+        }
+        if (nShards == 0) nShards = 1;
+        if (depth < 1) depth = 1;
+        if (depth > MAXPIPE) depth = MAXPIPE;
+        //retry backoffs are random so clients that timed out together don't retry together
+        srand(getpid() ^ time(NULL));
+
+        //this client's id picks its FIFO pair; default to 1 if solo client (for part 2)
+        int clientID = (optind < argc) ? strtol(argv[optind], NULL, 10) : 1;
+        if (clientID < 1 || clientID > NCLIENT){
+            printf(CTAG "client idNumber must be 1 to %d.\n", NCLIENT);
+            exit(EXIT_FAILURE);
+        }
+        //set up the FIFO pipes, one pair per shard
+        for (int s = 0; s < nShards; s++){
+            char fifoStoC[MAXLINE];
+            char fifoCtoS[MAXLINE];
+            snprintf(fifoStoC, sizeof(fifoStoC), "%s/fifo-0-%d", shards[s].dir, clientID);
+            snprintf(fifoCtoS, sizeof(fifoCtoS), "%s/fifo-%d-0", shards[s].dir, clientID);
+
+            shards[s].cliFD = open(fifoCtoS, O_RDWR);     //write to pipe: client-to-server
+                if (shards[s].cliFD < 0){
+                    printf(CTAG "open c|s fd [%s] failed.\n", fifoCtoS);
+                } else printf(CTAG "open c|s fd [%d]\n", shards[s].cliFD);
+            shards[s].servFD = open(fifoStoC, O_RDWR);    //read from server pipe
+                if (shards[s].servFD < 0){
+                    printf(CTAG "open s|c fd [%s] failed.\n", fifoStoC);
+                } else printf(CTAG "open s|c fd [%d]\n", shards[s].servFD);
+        }
+
+        //ask for read leases if this client caches; a server may grant a shorter one,
+        //and the shortest granted is used for every shard
+        if (leaseMs > 0){
+            int granted = leaseMs;
+            for (int s = 0; s < nShards; s++){
+                FRAME leaseReq = initFrame();
+                leaseReq.kind = lease;
+                leaseReq.data = packIntM(clientID, lease, leaseMs);
+                FRAME gotLease = initFrame();
+                if (!shardCall(&shards[s], &leaseReq, &gotLease)) granted = 0;
+                else if (gotLease.data.package.mInt.argument < granted) granted = gotLease.data.package.mInt.argument;
+            }
+            leaseMs = (granted > 0) ? granted : 0;
+            printf(CTAG "client cache on: [%d] ms leases.\n", leaseMs);
+        }
 
         //run in client mode; open an instructions file
         FILE *clientData = fopen(argv[2], "r");
@@ -401,9 +1138,9 @@ LOAD: [%s], [%s], [%s]\n",
         //each {, }, is a packet block indicator
 
         //some array setups for Tokenizer
-        char tokens[3][MAXWORD];
+        char tokens[MAX_NTOKENS][MAXWORD];
             memset(tokens, 0, sizeof(tokens));
-        char* tokenPointers[3];
+        char* tokenPointers[MAX_NTOKENS];
             memset(tokenPointers, 0, sizeof(tokenPointers));
         char command[3][MAXWORD];
             memset(command, 0, sizeof(command));
@@ -436,16 +1173,30 @@ LOAD: [%s], [%s], [%s]\n",
                     // currLine starts with a number (client ID)
                     if (isdigit(currLine[0]) != 0){
 
-                        Tokenizer(currLine, tokens, seps, tokenPointers);       //tokenize command
-                        workclientID = strtol(tokens[1], NULL, 10);             //grab client id
+                        int nTokens = Tokenizer(currLine, tokens, seps, tokenPointers);   //tokenize command
+                        workclientID = strtol(tokens[0], NULL, 10);             //grab client id
                         KIND checkType = getFrameKind(tokens[1]);               //grab command type
                         strncpy(objectName, tokens[2], MAXWORD);                //grab the object name
+                        int expectVersion = (nTokens > 3) ? strtol(tokens[3], NULL, 10) : ANYVERSION;   //optional version condition
+
+                        //another client's line: skip it, and its data block if it has one
+                        if (workclientID != clientID){
+                            if (checkType == put){
+                                while (getline(&currLine, &len, clientData) != -1 && currLine[0] != '}');
+                            }
+                            break;
+                        }
 
                         FRAME thisFrame = initFrame();
                         FRAME gotAck = initFrame();
                         DATA payload;
                             memset(&payload, 0, sizeof(payload));
 
+                        //puts, gets and deletes go to the object's shard and may be pipelined;
+                        //anything else waits for every outstanding reply first
+                        shardLink *shard = &shards[shardOf(objectName, nShards)];
+                        if (checkType != put && checkType != get && checkType != delete) shardsFinish(shards, nShards, leaseMs);
+
                         //What kind of command are we dealing with?
                         //Create a proper frame within each command type case.
                         switch (checkType){
@@ -475,49 +1226,53 @@ LOAD: [%s], [%s], [%s]\n",
                                 //got the nice juicy data; need to package it
                                 payload = packStrM(structDataArray[0], structDataArray[1], structDataArray[2]);
                                 thisFrame.data = packData(workclientID, objectName, payload.package.mStr);
+                                thisFrame.data.package.mObj.version = expectVersion;
                                 //reinitialize for next block
                                 memset(objectName, 0, sizeof(objectName));
                                 workclientID = 1;
                                 blockCounter = 0;
-                                //do stuff with thisFrame
+                                //do stuff with thisFrame; the ack is read by shardReply()
                                 printFrame("c to s: ", &thisFrame);
-                                sendFrame(cliFD, thisFrame.kind, &thisFrame.data);
-                                //get ack
-                                gotAck = receiveFrame(servFD);
-                                printFrame("s msg: ", &gotAck);
+                                if (noReply && expectVersion == ANYVERSION) shardQuiet(shard, &thisFrame);
+                                else shardSend(shard, &thisFrame, depth, leaseMs);
                                 break;
 
                             case get:;
                                 thisFrame.kind = get;
                                 thisFrame.data = packData(workclientID, objectName, payload.package.mStr);
+                                //serve from the cache while the lease holds; apply any invalidations first
+                                if (leaseMs > 0){
+                                    while (shard->n > 0) shardReply(shard, leaseMs);
+                                    clientDrain(shard->servFD);
+                                    cacheEntry *cached = cacheLookup(objectName);
+                                    if (cached != NULL){
+                                        thisFrame.data.package.mObj = cached->obj;
+                                        printFrame("cache hit: ", &thisFrame);
+                                        break;
+                                    }
+                                }
                                 //do stuff with thisFrame
                                 printFrame("c to s", &thisFrame);
-                                sendFrame(cliFD, thisFrame.kind, &thisFrame.data);
-                                //get ack
-                                gotAck = receiveFrame(servFD);
-                                printFrame("s msg: ", &gotAck);
+                                shardSend(shard, &thisFrame, depth, leaseMs);
                                 break;
 
                             case delete:
                                 thisFrame.kind = delete;
                                 thisFrame.data = packData(workclientID, objectName, payload.package.mStr);
+                                thisFrame.data.package.mObj.version = expectVersion;
                                 printFrame("c to s", &thisFrame);
-                                sendFrame(cliFD, thisFrame.kind, &thisFrame.data);
-                                gotAck = receiveFrame(servFD);
-                                printFrame("s msg: ", &gotAck);
+                                if (noReply && expectVersion == ANYVERSION) shardQuiet(shard, &thisFrame);
+                                else shardSend(shard, &thisFrame, depth, leaseMs);
                                 break;
 
                             case gtime:
                                 thisFrame.kind = gtime;
                                 thisFrame.data = packData(workclientID, objectName, payload.package.mStr);
-                                //do stuff with thisFrame
+                                //do stuff with thisFrame; uptime is the first shard's
                                 printFrame("c to s", &thisFrame);
-                                sendFrame(cliFD, thisFrame.kind, &thisFrame.data);
-                                //get ack
-                                FRAME gotACK = receiveFrame(servFD);
-                                printFrame("s msg: ", &gotACK);
-                                //get time
-                                FRAME gotTime = receiveFrame(servFD);
+                                //the time is the whole reply
+                                FRAME gotTime = initFrame();
+                                if (!shardCall(&shards[0], &thisFrame, &gotTime)) break;
                                 printFrame("SERVER UPTIME: ", &gotTime);
                                 break;
 
@@ -526,13 +1281,84 @@ LOAD: [%s], [%s], [%s]\n",
                                 int millisec = strtol(tokens[2], NULL, 10);
                                 thisFrame.data = packIntM(workclientID, delay, millisec);
                                 printf(CTAG "client command DELAY; sleeping for [%d.%.2d]s.\n", millisec/1000, millisec%1000);
-                                usleep(millisec*1000);
+                                clientWait(shards, nShards, millisec);
+                                break;
+
+                            case list:;
+                                //"list prefix" or "list low high"; page through each shard in turn with a cursor
+                                int isPrefix = (nTokens < 4);
+                                for (int s = 0; s < nShards; s++){
+                                    if (nShards > 1) printf(CTAG "shard [%d] (%s):\n", s, shards[s].dir);
+                                    char listCursor[MAXWORD];
+                                        memset(listCursor, 0, sizeof(listCursor));
+                                    int hasMore = 1;
+                                    int stalls = 0;
+                                    while (hasMore){
+                                        thisFrame.kind = list;
+                                        thisFrame.data = packListM(isPrefix, tokens[2], isPrefix ? "" : tokens[3], listCursor);
+                                        printFrame("c to s", &thisFrame);
+                                        if (!shardCall(&shards[s], &thisFrame, &gotAck)) break;
+                                        printFrame("s msg: ", &gotAck);
+                                        //names stream back in batches until the last frame of the page;
+                                        //if they stop coming, ask again from the last name that came (-a times)
+                                        hasMore = 0;
+                                        FRAME gotNames = initFrame();
+                                        do {
+                                            if (!shardRecv(&shards[s], thisFrame.seq, thisFrame.deadline, &gotNames)){
+                                                hasMore = (++stalls <= clientCalls.retries);
+                                                printf(CTAG "list page stopped; %s.\n", hasMore ? "asking again from the last name" : "giving up");
+                                                break;
+                                            }
+                                            if (gotNames.kind != list) break;
+                                            printFrame("LIST: ", &gotNames);
+                                            nameMsg *names = &gotNames.data.package.mNames;
+                                            if (names->count > 0) snprintf(listCursor, sizeof(listCursor), "%s", names->names[names->count-1]);
+                                            hasMore = names->more;
+                                        } while (!gotNames.data.package.mNames.last);
+                                    }
+                                }
+                                break;
+
+                            case stats:;
+                                thisFrame.kind = stats;
+                                thisFrame.data = packIntM(workclientID, stats, 0);
+                                printFrame("c to s", &thisFrame);
+                                for (int s = 0; s < nShards; s++){
+                                    if (nShards > 1) printf(CTAG "shard [%d] (%s):\n", s, shards[s].dir);
+                                    //ack argument says how many report frames follow
+                                    if (!shardCall(&shards[s], &thisFrame, &gotAck)) continue;
+                                    for (int r = 0; r < gotAck.data.package.mInt.argument; r++){
+                                        FRAME gotStats = initFrame();
+                                        if (!shardRecv(&shards[s], thisFrame.seq, thisFrame.deadline, &gotStats)) break;
+                                        printFrame("SERVER STATS: ", &gotStats);
+                                    }
+                                }
+                                break;
+
+                            case watch:
+                            case unwatch:
+                                //a prefix can match names on any shard
+                                thisFrame.kind = checkType;
+                                thisFrame.data = packData(workclientID, objectName, payload.package.mStr);
+                                printFrame("c to s", &thisFrame);
+                                for (int s = 0; s < nShards; s++){
+                                    if (shardCall(&shards[s], &thisFrame, &gotAck)) printFrame("s msg: ", &gotAck);
+                                }
                                 break;
 
                             case quit:
                                 thisFrame.kind = quit;
                                 thisFrame.data = packIntM(workclientID, quit, 0);
-                                break;
+                                printFrame("c to s", &thisFrame);
+                                for (int s = 0; s < nShards; s++){
+                                    if (shardCall(&shards[s], &thisFrame, &gotAck)) printFrame("s msg: ", &gotAck);
+                                }
+                                if (clientCalls.timeoutMs > 0){
+                                    printf(CTAG "requests [%ld]: timed out [%ld], retried [%ld], given up [%ld], stale replies [%ld].\n",
+                                        clientCalls.sent, clientCalls.timedOut, clientCalls.retried, clientCalls.failed, clientCalls.stale);
+                                }
+                                printf(CTAG "client [%d] quit.\n", clientID);
+                                exit(EXIT_SUCCESS);
 
                             default:
                                 break;
@@ -589,7 +1415,7 @@ int Tokenizer(char inputStr[], char tokens[MAX_NTOKENS][MAXWORD], char separator
 	memset(inputStrCopy, 0, sizeof(inputStrCopy));
 
 	//clear output array;
-	for (int i = 0; i <= MAX_NTOKENS; i++) {
+	for (int i = 0; i < MAX_NTOKENS; i++) {
 			memset(tokens[i], 0, sizeof(tokens[i]));
 		}	
 
@@ -608,7 +1434,7 @@ int Tokenizer(char inputStr[], char tokens[MAX_NTOKENS][MAXWORD], char separator
 	count++;
 
 	//walk through other tokens in the string
-	while((tokenPointer = strtok(NULL, separators)) != NULL)
+	while(count < MAX_NTOKENS && (tokenPointer = strtok(NULL, separators)) != NULL)
 	{
 		strcpy(tokens[count], tokenPointer);
 		//printf("[%s]", tokenPointer);
@@ -650,7 +1476,14 @@ KIND getFrameKind(char *whatKind){
         {done, "done"},
         {quit, "quit"},
         {invalid, "invalid"},
-        {stime, "stime"},         //...9
+        {stime, "stime"},
+        {list, "list"},
+        {stats, "stats"},
+        {watch, "watch"},
+        {unwatch, "unwatch"},
+        {notify, "notify"},
+        {lease, "lease"},
+        {inval, "inval"},       //...17
     };
 
     KIND result = -1;
@@ -735,6 +1568,30 @@ DATA packData(int ID, char name[], strMsg package){
     return mOBJ;
 }
 
+/**
+ * packListM:
+ * 
+ * Packages a list request for delivery in a frame.
+ * 
+ * int prefix = 1 to match names starting with low, 0 to match names in [low, high);
+ * low, high = bounds of the scan (high may be "" for no upper bound);
+ * cursor = last name of the previous page, or "" for the first page;
+ * 
+*/
+DATA packListM(int prefix, const char *low, const char *high, const char *cursor){
+    DATA mLIST;
+    memset(&mLIST, 0, sizeof(DATA));
+
+    mLIST.TYPE = 3;
+    mLIST.package.mList.prefix = prefix;
+    mLIST.package.mList.limit = LISTPAGE;
+    strncpy(mLIST.package.mList.low, low, MAXWORD-1);
+    strncpy(mLIST.package.mList.high, high, MAXWORD-1);
+    strncpy(mLIST.package.mList.cursor, cursor, MAXWORD-1);
+
+    return mLIST;
+}
+
 /**
  * printFrame:
  * 
@@ -751,15 +1608,15 @@ void printFrame(const char *userPrefix, FRAME *frame){
     switch (frame->kind)
     {
     case get:
-        printf("[[%d, %s]]", data.package.mObj.owner, data.package.mObj.name);
+        printf("[[%d, %s, v%d]]", data.package.mObj.owner, data.package.mObj.name, data.package.mObj.version);
         break;
     
     case put:
-        printf("[[%d, %s]]", data.package.mObj.owner, data.package.mObj.name);
+        printf("[[%d, %s, v%d]]", data.package.mObj.owner, data.package.mObj.name, data.package.mObj.version);
         break;
     
     case delete:
-        printf("[[%d, %s]]", data.package.mObj.owner, data.package.mObj.name);
+        printf("[[%d, %s, v%d]]", data.package.mObj.owner, data.package.mObj.name, data.package.mObj.version);
         break;
     
     case gtime:
@@ -775,7 +1632,10 @@ void printFrame(const char *userPrefix, FRAME *frame){
         break;
     
     case ack:
-        printf("[packagetype[%d], framekind[%d]]", data.package.mInt.clientID, data.package.mInt.kind);
+        if (data.package.mInt.argument < 0 && data.package.mInt.argument >= st_readonly){
+            printf("[framekind[%d], error[%s]]", data.package.mInt.kind, statusList[-data.package.mInt.argument]);
+        }
+        else printf("[framekind[%d], version[%d]]", data.package.mInt.kind, data.package.mInt.argument);
         break;
     
     case done:
@@ -794,6 +1654,50 @@ void printFrame(const char *userPrefix, FRAME *frame){
         printf("[%d seconds]", data.package.mInt.argument);
         break;
 
+    case watch:
+    case unwatch:
+        printf("[[%d, %s*]]", data.package.mObj.owner, data.package.mObj.name);
+        break;
+
+    case lease:
+        printf("[[%d, %d ms]]", data.package.mInt.clientID, data.package.mInt.argument);
+        break;
+
+    case inval:
+        printf("[[%s, v%d]]", data.package.mObj.name, data.package.mObj.version);
+        break;
+
+    case repl:
+        printf("[[%s, epoch %d, seq %d]]", commandList[data.package.mInt.kind], data.package.mInt.clientID, data.package.mInt.argument);
+        break;
+
+    case notify:
+        if (data.package.mEvents.dropped) printf("(%d dropped) ", data.package.mEvents.dropped);
+        for (int i = 0; i < data.package.mEvents.count && i < NOTIFYBATCH; i++){
+            printf("%s[%s %s v%d]", i ? ", " : "", commandList[data.package.mEvents.events[i].op],
+                data.package.mEvents.events[i].name, data.package.mEvents.events[i].version);
+        }
+        break;
+
+    case stats:
+        if (data.TYPE == 1){
+            printf("\n\t%s\n\t%s\n\t%s", data.package.mStr.data1, data.package.mStr.data2, data.package.mStr.data3);
+        }
+        else printf("[%d]", data.package.mInt.clientID);
+        break;
+
+    case list:
+        if (data.TYPE == 3){
+            printf("[[%s, %s, %s]]", data.package.mList.low, data.package.mList.high, data.package.mList.cursor);
+        }
+        else {
+            for (int i = 0; i < data.package.mNames.count && i < LISTBATCH; i++){
+                printf("%s[%s]", i ? ", " : "", data.package.mNames.names[i]);
+            }
+            if (data.package.mNames.more) printf(" ...");
+        }
+        break;
+
     default:
         printf("UNKNOWN KIND: %d\n", frame->kind);
         break;
@@ -830,6 +1734,15 @@ void sendFrame (int fd, KIND kind, DATA *data){
     case 2:
         send.data.package.mObj = data->package.mObj;
         break;
+    case 3:
+        send.data.package.mList = data->package.mList;
+        break;
+    case 4:
+        send.data.package.mNames = data->package.mNames;
+        break;
+    case 5:
+        send.data.package.mEvents = data->package.mEvents;
+        break;
     default:
         break;
     }
@@ -889,29 +1802,27 @@ int clientRequestID(int fifoC, int fifoS){
 /**
  * serverACK
  * 
- * Send simple ack msg across a FIFO for printing on the other side.
- * int clientFD: fifo to sent msg
+ * Queue simple ack msg for a client's FIFO for printing on the other side.
+ * cliState *cli: client to send msg to
  * KIND frameKind: msg type recv'd
- * int dataType: type of data package in the frame client had sent
+ * int result: outcome of the request; an object version (>= 0) or a STATUS error
  * 
- * returns -1 if error, otherwise returns clientFD
+ * returns -1 if error, otherwise returns the client's fifo
 */
-int serverACK(int servFD, KIND frameKind, int dataType){
+int serverACK(cliState *cli, KIND frameKind, int result){
     FRAME ackF;
-    memset(&ackF, 0, sizeof(ack));
+    memset(&ackF, 0, sizeof(FRAME));
     ackF.kind = ack;
-    ackF.data = packIntM(0, frameKind, dataType);
-    int nwrote = 0;
+    ackF.data = packIntM(0, frameKind, result);
 
-    nwrote = write(servFD, &ackF, sizeof(FRAME));
     printFrame("Server send ACK:", &ackF);
-    if (nwrote == -1){
-        printf("server ack send error: fd %d giving error %s.\n", servFD, strerror(errno));
+    if (serverReply(cli, &ackF, 1) != 1){
+        printf("server ack send error: client [%d] reply queue full.\n", cli->id);
         return -1;
     }
     else {
-        printf("server ack sent: %d bytes to %d.\n", nwrote, servFD);
-        return servFD;
+        printf("server ack queued: %zu bytes for %d.\n", sizeof(FRAME), cli->outFD);
+        return cli->outFD;
     }
 }
 
@@ -925,4 +1836,3235 @@ FRAME initFrame(){
     FRAME newFrame;
     memset(&newFrame, 0, sizeof(FRAME));
     return newFrame;
-}
\ No newline at end of file
+}
+/**
+ * tableInit
+ * 
+ * Allocate an empty object table with room for size objects.
+ * 
+ * returns 0 on success, -1 if memory could not be allocated
+*/
+int tableInit(sTable *table, int size){
+    memset(table, 0, sizeof(sTable));
+    table->objects = calloc(size, sizeof(sObject));
+    table->replies = calloc(size, sizeof(*table->replies));
+    table->replyValid = calloc(size, sizeof(char));
+    table->used = calloc(size, sizeof(char));
+    table->refBit = calloc(size, sizeof(char));
+    table->freeSlots = calloc(size, sizeof(int));
+    table->index.next = calloc(size, sizeof(*table->index.next));
+    if (!table->objects || !table->replies || !table->replyValid || !table->used || !table->refBit || !table->freeSlots || !table->index.next){
+        tableFree(table);
+        return -1;
+    }
+    table->size = size;
+    //hand out low slots first
+    for (int i = 0; i < size; i++) table->freeSlots[i] = size - 1 - i;
+    table->nFree = size;
+    table->index.levels = 1;
+    for (int l = 0; l < SKIPLEVELS; l++) table->index.head[l] = -1;
+    return 0;
+}
+
+/**
+ * tableFree
+ * 
+ * Release the memory held by an object table.
+*/
+void tableFree(sTable *table){
+    free(table->objects);
+    free(table->replies);
+    free(table->replyValid);
+    free(table->used);
+    free(table->refBit);
+    free(table->freeSlots);
+    free(table->index.next);
+    memset(table, 0, sizeof(sTable));
+}
+
+/**
+ * skipSearch (helper)
+ * 
+ * Walk the skiplist towards key, filling prev[l] with the last slot on each
+ * level whose name sorts before key (or at/before key if after is set);
+ * -1 in prev[l] means the list head.
+ * 
+ * returns the first slot on level 0 past that point, or -1.
+*/
+static int skipSearch(sTable *table, const char *key, int after, int prev[SKIPLEVELS]){
+    nameIndex *idx = &table->index;
+    int curr = -1;
+    for (int l = idx->levels - 1; l >= 0; l--){
+        int nxt = (curr < 0) ? idx->head[l] : idx->next[curr][l];
+        while (nxt >= 0){
+            int cmp = strncmp(table->objects[nxt].name, key, MAXWORD);
+            if (cmp > 0 || (cmp == 0 && !after)) break;
+            curr = nxt;
+            nxt = idx->next[curr][l];
+        }
+        if (prev) prev[l] = curr;
+    }
+    return (curr < 0) ? idx->head[0] : idx->next[curr][0];
+}
+
+/**
+ * tableFind
+ * 
+ * returns the slot holding the object called name, or -1 if there is none.
+*/
+int tableFind(sTable *table, const char *name){
+    int slot = skipSearch(table, name, 0, NULL);
+    if (slot >= 0 && strncmp(table->objects[slot].name, name, MAXWORD) == 0) return slot;
+    return -1;
+}
+
+/**
+ * tablePut
+ * 
+ * Copy obj into a free slot and link it into the name index.
+ * 
+ * returns the slot used, -1 if the table is full, -2 if the name already exists
+*/
+int tablePut(sTable *table, sObject *obj){
+    int prev[SKIPLEVELS];
+    int slot = skipSearch(table, obj->name, 0, prev);
+    if (slot >= 0 && strncmp(table->objects[slot].name, obj->name, MAXWORD) == 0) return -2;
+    if (table->nFree == 0) return -1;
+
+    slot = table->freeSlots[--table->nFree];
+    table->objects[slot] = *obj;
+    table->replyValid[slot] = 0;
+    table->used[slot] = 1;
+    table->refBit[slot] = 0;
+    table->count += 1;
+    table->residentBytes += objectBytes(obj);
+
+    //pick a level with p = 1/4 per extra level
+    nameIndex *idx = &table->index;
+    int level = 1;
+    while (level < SKIPLEVELS && (rand() & 3) == 0) level++;
+    for (int l = idx->levels; l < level; l++) prev[l] = -1;
+    if (level > idx->levels) idx->levels = level;
+
+    for (int l = 0; l < SKIPLEVELS; l++) idx->next[slot][l] = -1;
+    for (int l = 0; l < level; l++){
+        if (prev[l] < 0){
+            idx->next[slot][l] = idx->head[l];
+            idx->head[l] = slot;
+        }
+        else {
+            idx->next[slot][l] = idx->next[prev[l]][l];
+            idx->next[prev[l]][l] = slot;
+        }
+    }
+    return slot;
+}
+
+/**
+ * tableDelete
+ * 
+ * Unlink the object called name from the index and free its slot.
+ * 
+ * returns the slot it occupied, or -1 if there is no such object
+*/
+int tableDelete(sTable *table, const char *name){
+    int prev[SKIPLEVELS];
+    int slot = skipSearch(table, name, 0, prev);
+    if (slot < 0 || strncmp(table->objects[slot].name, name, MAXWORD) != 0) return -1;
+
+    nameIndex *idx = &table->index;
+    for (int l = 0; l < idx->levels; l++){
+        int *link = (prev[l] < 0) ? &idx->head[l] : &idx->next[prev[l]][l];
+        if (*link == slot) *link = idx->next[slot][l];
+    }
+    while (idx->levels > 1 && idx->head[idx->levels - 1] < 0) idx->levels--;
+
+    table->residentBytes -= objectBytes(&table->objects[slot]);
+    memset(&table->objects[slot], 0, sizeof(sObject));
+    table->replyValid[slot] = 0;
+    table->used[slot] = 0;
+    table->freeSlots[table->nFree++] = slot;
+    table->count -= 1;
+    return slot;
+}
+
+/**
+ * tableSeek
+ * 
+ * returns the first slot whose name sorts at or after key (strictly after
+ * key if after is set), or -1 if the scan is past the end.
+*/
+int tableSeek(sTable *table, const char *key, int after){
+    return skipSearch(table, key, after, NULL);
+}
+
+/**
+ * tableNext
+ * 
+ * returns the slot that follows slot in name order, or -1 at the end.
+*/
+int tableNext(sTable *table, int slot){
+    return table->index.next[slot][0];
+}
+
+/**
+ * listMatch (helper)
+ * 
+ * returns 1 if name, at or past the start of a list request's range, is
+ * still inside it (has its prefix, or sorts before its high end)
+*/
+static int listMatch(listMsg *req, const char *name){
+    if (req->prefix) return strncmp(name, req->low, strnlen(req->low, MAXWORD)) == 0;
+    return req->high[0] == '\0' || strncmp(name, req->high, MAXWORD) < 0;
+}
+
+/**
+ * serverList
+ * 
+ * Answer a list request: scan the name index from the request's cursor (or
+ * its lower bound) and stream back up to one page of matching names,
+ * LISTBATCH names per frame. Cold objects (-D) aren't in the index; their
+ * names in range are gathered, sorted and merged in. The whole page is
+ * queued at once.
+ * 
+ * returns the number of names sent
+*/
+int serverList(cliState *cli, sTable *table, listMsg *req){
+    FRAME page[LISTPAGE / LISTBATCH + 1];
+    memset(page, 0, sizeof(page));
+    int limit = (req->limit > 0 && req->limit < LISTPAGE) ? req->limit : LISTPAGE;
+
+    int slot = (req->cursor[0] != '\0') ? tableSeek(table, req->cursor, 1) : tableSeek(table, req->low, 0);
+    char (*coldNames)[MAXWORD] = NULL;
+    int nCold = coldRange(table->cold, req, &coldNames);
+    int c = 0;
+    int sent = 0;
+    int nFrames = 0;
+    nameMsg *batch = NULL;
+
+    for (; sent < limit; sent++){
+        if (slot >= 0 && !listMatch(req, table->objects[slot].name)) slot = -1;
+        if (slot < 0 && c == nCold) break;
+        const char *name;
+        if (slot >= 0 && (c == nCold || strncmp(table->objects[slot].name, coldNames[c], MAXWORD) < 0)){
+            name = table->objects[slot].name;
+            slot = tableNext(table, slot);
+        }
+        else name = coldNames[c++];
+
+        if (batch == NULL || batch->count == LISTBATCH){
+            page[nFrames].kind = list;
+            page[nFrames].data.TYPE = 4;
+            batch = &page[nFrames].data.package.mNames;
+            nFrames++;
+        }
+        strncpy(batch->names[batch->count++], name, MAXWORD);
+    }
+    if (slot >= 0 && !listMatch(req, table->objects[slot].name)) slot = -1;
+
+    //always answer with at least one (possibly empty) frame
+    if (nFrames == 0){
+        page[0].kind = list;
+        page[0].data.TYPE = 4;
+        batch = &page[0].data.package.mNames;
+        nFrames = 1;
+    }
+    //only a page that filled up can have more: one cut short ran out of names in range
+    batch->last = 1;
+    batch->more = (sent == limit) && (slot >= 0 || c < nCold);
+    free(coldNames);
+
+    if (serverReply(cli, page, nFrames) != nFrames){
+        printf("serverList error: client [%d] reply queue full\n", cli->id);
+    }
+    return sent;
+}
+
+/**
+ * versionCheck
+ * 
+ * The version a put or delete is conditioned on must be a real version
+ * (0 and up), or ANYVERSION for no condition.
+ * 
+ * returns st_ok, or st_badversion for anything else
+*/
+int versionCheck(int expected){
+    return (expected >= 0 || expected == ANYVERSION) ? st_ok : st_badversion;
+}
+
+/**
+ * tableSet
+ * 
+ * Store obj under its name, subject to a version condition:
+ *  expected == ANYVERSION: create only; fails if the name exists;
+ *  expected == 0: same, but reported as a version conflict;
+ *  expected > 0: replace the object only if it is still at that version.
+ * There is no unconditional overwrite, as there was none before versions:
+ * to replace an object, get it and put with the version read. The check
+ * and the update happen together, so no other request can slip in between.
+ * Once MAXVERSION has been handed out every put fails with st_full rather
+ * than reuse a version or wrap into the STATUS codes. A cold object is
+ * checked against its key directory entry and replaced without being read
+ * back.
+ * 
+ * returns the object's new version, or a STATUS error
+*/
+int tableSet(sTable *table, sObject *obj, int expected){
+    if (versionCheck(expected) != st_ok) return st_badversion;
+    if (table->lastVersion == MAXVERSION) return st_full;
+    int slot = tableFind(table, obj->name);
+    coldEntry *entry = (slot < 0) ? coldFind(table->cold, obj->name) : NULL;
+    int isCold = (entry != NULL);
+
+    if (expected > 0 && isCold){
+        if (entry->version != expected) return st_conflict;
+    }
+    else if (expected > 0){
+        if (slot < 0) return st_notfound;
+        if (table->objects[slot].version != expected) return st_conflict;
+        long growth = objectBytes(obj) - objectBytes(&table->objects[slot]);
+        if (growth > 0 && tableEvict(table, growth, slot) < 0) return st_full;
+        table->residentBytes += growth;
+        table->objects[slot] = *obj;
+        table->objects[slot].version = ++table->lastVersion;
+        table->replyValid[slot] = 0;
+        return table->lastVersion;
+    }
+    else if (slot >= 0 || isCold) return (expected == 0) ? st_conflict : st_exists;
+
+    if (tableEvict(table, objectBytes(obj), -1) < 0) return st_full;
+    slot = tablePut(table, obj);
+    if (slot < 0) return st_full;
+    if (isCold) coldDrop(table->cold, obj->name);
+    table->objects[slot].version = ++table->lastVersion;
+    return table->lastVersion;
+}
+
+/**
+ * tableRemove
+ * 
+ * Delete the object called name; if expected is not ANYVERSION the object
+ * must still be at that version.
+ * 
+ * returns the version that was deleted, or a STATUS error
+*/
+int tableRemove(sTable *table, const char *name, int expected){
+    if (versionCheck(expected) != st_ok) return st_badversion;
+    int slot = tableFind(table, name);
+    if (slot < 0){
+        coldEntry *entry = coldFind(table->cold, name);
+        if (entry == NULL) return st_notfound;
+        int version = entry->version;
+        if (expected != ANYVERSION && version != expected) return st_conflict;
+        coldDrop(table->cold, name);
+        return version;
+    }
+    int version = table->objects[slot].version;
+    if (expected != ANYVERSION && version != expected) return st_conflict;
+    tableDelete(table, name);
+    return version;
+}
+
+/**
+ * tableApply
+ * 
+ * Store obj exactly as given, version and all, creating or replacing it;
+ * a replica applies its primary's changes this way, without conditions.
+ * 
+ * returns the object's version, or st_full if there is no room for it
+*/
+int tableApply(sTable *table, sObject *obj){
+    int slot = tableFind(table, obj->name);
+
+    if (slot >= 0){
+        long growth = objectBytes(obj) - objectBytes(&table->objects[slot]);
+        if (growth > 0 && tableEvict(table, growth, slot) < 0) return st_full;
+        table->residentBytes += growth;
+        table->objects[slot] = *obj;
+        table->replyValid[slot] = 0;
+    }
+    else {
+        if (tableEvict(table, objectBytes(obj), -1) < 0) return st_full;
+        if (tablePut(table, obj) < 0) return st_full;
+        coldDrop(table->cold, obj->name);
+    }
+    if (obj->version > table->lastVersion) table->lastVersion = obj->version;
+    return obj->version;
+}
+
+/**
+ * serverGet
+ * 
+ * Answer a get request. A hit is queued as the slot's pre-encoded get frame,
+ * which carries the object and its version, so no ack goes with it; the
+ * frame is built on the first get after the object changes and reused until
+ * the next put or delete. A cold object is read back into the table first.
+ * 
+ * returns the slot sent, or -1 if there is no such object (a not found
+ * ack is sent instead)
+*/
+int serverGet(cliState *cli, sTable *table, const char *name){
+    int slot = tableFind(table, name);
+    if (slot < 0) slot = tableFault(table, name);
+    if (slot < 0){
+        table->misses++;
+        serverACK(cli, get, st_notfound);
+        return -1;
+    }
+    table->hits++;
+    table->refBit[slot] = 1;
+
+    FRAME *reply = &table->replies[slot];
+    if (!table->replyValid[slot]){
+        sObject *obj = &table->objects[slot];
+        memset(reply, 0, sizeof(FRAME));
+        reply->kind = get;
+        reply->data = packData(obj->owner, obj->name, obj->package);
+        reply->data.package.mObj.version = obj->version;
+        table->replyValid[slot] = 1;
+    }
+
+    if (serverReply(cli, reply, 1) != 1){
+        printf("serverGet error: client [%d] reply queue full\n", cli->id);
+    }
+    return slot;
+}
+
+/**
+ * objectBytes
+ * 
+ * returns the bytes an object is charged against the cache budget: the
+ * length of its name and of its data lines.
+*/
+long objectBytes(sObject *obj){
+    return strnlen(obj->name, MAXWORD)
+        + strnlen(obj->package.data1, MAXLINELENGTH)
+        + strnlen(obj->package.data2, MAXLINELENGTH)
+        + strnlen(obj->package.data3, MAXLINELENGTH);
+}
+
+/**
+ * tableEvict
+ * 
+ * Make room for needBytes more resident bytes and one more object. Without
+ * a budget or a cold tier this only checks for a free slot; otherwise the
+ * clock hand sweeps the slots, giving objects with their reference bit set
+ * a second chance and evicting the first one without it (to the cold tier,
+ * if there is one). keepSlot (or -1) is never evicted; it is the object
+ * about to grow.
+ * 
+ * returns 0 once there is room, -1 if there can't be
+*/
+int tableEvict(sTable *table, long needBytes, int keepSlot){
+    if (table->budget <= 0 && table->cold == NULL) return (keepSlot >= 0 || table->nFree > 0) ? 0 : -1;
+    if (table->budget > 0 && needBytes > table->budget) return -1;
+
+    while ((table->budget > 0 && table->residentBytes + needBytes > table->budget) || (keepSlot < 0 && table->nFree == 0)){
+        //two full sweeps clear every reference bit, so a victim turns up
+        int victim = -1;
+        for (int step = 0; step < 2 * table->size && victim < 0; step++){
+            int slot = table->clockHand;
+            table->clockHand = (table->clockHand + 1) % table->size;
+            if (!table->used[slot] || slot == keepSlot) continue;
+            if (table->refBit[slot]) table->refBit[slot] = 0;
+            else victim = slot;
+        }
+        if (victim < 0) return -1;
+        if (table->cold != NULL && coldSpill(table->cold, &table->objects[victim]) < 0) return -1;
+        printf(STAG "cache %s [%s] (%ld bytes).\n", table->cold ? "spilling" : "evicting", table->objects[victim].name, objectBytes(&table->objects[victim]));
+        tableDelete(table, table->objects[victim].name);
+        table->evictions++;
+    }
+    return 0;
+}
+
+/**
+ * tableFault
+ * 
+ * Bring the cold object called name back into the table, evicting others
+ * to make room for it.
+ * 
+ * returns its slot, or -1 if there is no such cold object (or no room)
+*/
+int tableFault(sTable *table, const char *name){
+    coldEntry *entry = coldFind(table->cold, name);
+    if (entry == NULL) return -1;
+    sObject obj;
+    if (coldRead(table->cold, entry, &obj) < 0) return -1;
+    //the entry goes only once the object is safely in the table
+    if (tableEvict(table, objectBytes(&obj), -1) < 0) return -1;
+    int slot = tablePut(table, &obj);
+    if (slot < 0) return -1;
+    coldDrop(table->cold, name);
+    return slot;
+}
+
+/**
+ * coldSegmentPath (helper)
+ * 
+ * Write the file name of cold segment seg into path.
+*/
+static void coldSegmentPath(coldStore *cold, int seg, char path[PATH_MAX]){
+    snprintf(path, PATH_MAX, "%s/cold-%03d.seg", cold->dir, seg);
+}
+
+/**
+ * coldSegmentNew (helper)
+ * 
+ * Create an empty segment in the first unused segment number.
+ * 
+ * returns the segment, or -1 if none is free or the file can't be created
+*/
+static int coldSegmentNew(coldStore *cold){
+    for (int seg = 0; seg < MAXSEGMENTS; seg++){
+        if (cold->segments[seg].fd >= 0) continue;
+        char path[PATH_MAX];
+        coldSegmentPath(cold, seg, path);
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0){
+            printf(STAG "Error creating cold segment [%s]: %s.\n", path, strerror(errno));
+            return -1;
+        }
+        cold->segments[seg].fd = fd;
+        cold->segments[seg].bytes = 0;
+        cold->segments[seg].dead = 0;
+        cold->segments[seg].stuck = 0;
+        return seg;
+    }
+    printf(STAG "cold tier has no free segment.\n");
+    return -1;
+}
+
+/**
+ * coldOpen
+ * 
+ * Set up an empty cold tier with its first segment in dir.
+ * 
+ * returns 0, or -1 if memory or the segment couldn't be had
+*/
+int coldOpen(coldStore *cold, const char *dir){
+    memset(cold, 0, sizeof(coldStore));
+    cold->dir = dir;
+    for (int seg = 0; seg < MAXSEGMENTS; seg++) cold->segments[seg].fd = -1;
+    cold->compacting = -1;
+    cold->capacity = KEYDIRSTART;
+    cold->keydir = calloc(cold->capacity, sizeof(coldEntry));
+    cold->bloom = calloc(cold->capacity, 1);
+    if (cold->keydir == NULL || cold->bloom == NULL){
+        printf(STAG "Error creating cold tier: %s.\n", strerror(errno));
+        return -1;
+    }
+    cold->active = coldSegmentNew(cold);
+    return (cold->active < 0) ? -1 : 0;
+}
+
+/**
+ * coldClose
+ * 
+ * Remove every segment and release the key directory; what was cold is gone.
+*/
+void coldClose(coldStore *cold){
+    for (int seg = 0; seg < MAXSEGMENTS; seg++){
+        if (cold->segments[seg].fd < 0) continue;
+        char path[PATH_MAX];
+        coldSegmentPath(cold, seg, path);
+        close(cold->segments[seg].fd);
+        unlink(path);
+    }
+    free(cold->keydir);
+    free(cold->bloom);
+    memset(cold, 0, sizeof(coldStore));
+}
+
+/**
+ * bloomBit (helper)
+ * 
+ * returns the i-th of a name's BLOOMHASHES filter bits, by double hashing
+ * its nameHash()
+*/
+static unsigned int bloomBit(coldStore *cold, unsigned int hash, int i){
+    unsigned int step = ((hash >> 17) | (hash << 15)) | 1;
+    return (hash + i * step) & (8u * cold->capacity - 1);
+}
+
+/**
+ * bloomAdd (helper)
+ * 
+ * Set a name's bits in the cold tier's Bloom filter.
+*/
+static void bloomAdd(coldStore *cold, const char *name){
+    unsigned int hash = nameHash(name);
+    for (int i = 0; i < BLOOMHASHES; i++){
+        unsigned int bit = bloomBit(cold, hash, i);
+        cold->bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+/**
+ * bloomBuild (helper)
+ * 
+ * Rebuild the Bloom filter from the names in the key directory, forgetting
+ * the ones dropped since it was last built.
+*/
+static void bloomBuild(coldStore *cold){
+    memset(cold->bloom, 0, cold->capacity);
+    for (int i = 0; i < cold->capacity; i++){
+        if (cold->keydir[i].name[0] != '\0') bloomAdd(cold, cold->keydir[i].name);
+    }
+    cold->bloomStale = 0;
+}
+
+/**
+ * keydirProbe (helper)
+ * 
+ * returns the key directory slot holding name, or the free slot where it
+ * would go
+*/
+static coldEntry *keydirProbe(coldStore *cold, const char *name){
+    unsigned int mask = cold->capacity - 1;
+    for (unsigned int i = nameHash(name) & mask; ; i = (i + 1) & mask){
+        coldEntry *entry = &cold->keydir[i];
+        if (entry->name[0] == '\0' || strncmp(entry->name, name, MAXWORD) == 0) return entry;
+    }
+}
+
+/**
+ * keydirGrow (helper)
+ * 
+ * Double the key directory (and the Bloom filter with it).
+ * 
+ * returns 0, or -1 if there is no memory for it
+*/
+static int keydirGrow(coldStore *cold){
+    coldEntry *old = cold->keydir;
+    int oldCapacity = cold->capacity;
+    coldEntry *keydir = calloc(2 * oldCapacity, sizeof(coldEntry));
+    unsigned char *bloom = calloc(2 * oldCapacity, 1);
+    if (keydir == NULL || bloom == NULL){
+        free(keydir);
+        free(bloom);
+        return -1;
+    }
+    cold->keydir = keydir;
+    cold->capacity = 2 * oldCapacity;
+    for (int i = 0; i < oldCapacity; i++){
+        if (old[i].name[0] != '\0') *keydirProbe(cold, old[i].name) = old[i];
+    }
+    free(old);
+    free(cold->bloom);
+    cold->bloom = bloom;
+    bloomBuild(cold);
+    return 0;
+}
+
+/**
+ * coldFind
+ * 
+ * Look a name up in the cold tier: the Bloom filter first, which rules out
+ * most absent names, then the key directory.
+ * 
+ * returns its entry, or NULL if it isn't cold (or there is no cold tier)
+*/
+coldEntry *coldFind(coldStore *cold, const char *name){
+    if (cold == NULL) return NULL;
+    unsigned int hash = nameHash(name);
+    for (int i = 0; i < BLOOMHASHES; i++){
+        unsigned int bit = bloomBit(cold, hash, i);
+        if (!(cold->bloom[bit >> 3] & (1 << (bit & 7)))){
+            cold->bloomSkips++;
+            return NULL;
+        }
+    }
+    coldEntry *entry = keydirProbe(cold, name);
+    if (entry->name[0] != '\0') return entry;
+    cold->falseHits++;
+    return NULL;
+}
+
+/**
+ * coldAppend (helper)
+ * 
+ * Append obj as a record to the active segment, starting a new one if it
+ * is full, and point entry at the record.
+ * 
+ * returns 0, or -1 if it couldn't be written
+*/
+static int coldAppend(coldStore *cold, sObject *obj, coldEntry *entry){
+    const char *fields[4] = {obj->name, obj->package.data1, obj->package.data2, obj->package.data3};
+    int limits[4] = {MAXWORD, MAXLINELENGTH, MAXLINELENGTH, MAXLINELENGTH};
+    char buffer[sizeof(coldRecord) + MAXWORD + 3 * MAXLINELENGTH];
+    coldRecord *record = (coldRecord *)buffer;
+    record->owner = obj->owner;
+    record->version = obj->version;
+    int len = sizeof(coldRecord);
+    for (int f = 0; f < 4; f++){
+        record->len[f] = strnlen(fields[f], limits[f]);
+        memcpy(buffer + len, fields[f], record->len[f]);
+        len += record->len[f];
+    }
+
+    coldSegment *seg = &cold->segments[cold->active];
+    if (seg->bytes + len > SEGMENTBYTES){
+        int next = coldSegmentNew(cold);
+        if (next < 0) return -1;
+        cold->active = next;
+        seg = &cold->segments[next];
+    }
+    if (pwrite(seg->fd, buffer, len, seg->bytes) != len){
+        printf(STAG "Error writing cold segment [%d]: %s.\n", cold->active, strerror(errno));
+        return -1;
+    }
+    entry->version = obj->version;
+    entry->segment = cold->active;
+    entry->offset = seg->bytes;
+    entry->len = len;
+    seg->bytes += len;
+    return 0;
+}
+
+/**
+ * coldSpill
+ * 
+ * Write an object being evicted from the table to the cold tier.
+ * 
+ * returns 0, or -1 if it couldn't be kept (it must not be evicted then)
+*/
+int coldSpill(coldStore *cold, sObject *obj){
+    //keep the key directory at most 70% full
+    if (10 * (cold->count + 1) > 7 * cold->capacity && keydirGrow(cold) < 0) return -1;
+    coldEntry *entry = keydirProbe(cold, obj->name);
+    coldEntry spilled = *entry;
+    if (coldAppend(cold, obj, &spilled) < 0) return -1;
+    if (entry->name[0] != '\0') cold->segments[entry->segment].dead += entry->len;
+    else cold->count++;
+    strncpy(spilled.name, obj->name, MAXWORD);
+    *entry = spilled;
+    bloomAdd(cold, obj->name);
+    cold->spilled++;
+    return 0;
+}
+
+/**
+ * coldRead
+ * 
+ * Read a cold object's record back from its segment.
+ * 
+ * returns 0, or -1 if it couldn't be read
+*/
+int coldRead(coldStore *cold, coldEntry *entry, sObject *obj){
+    char buffer[sizeof(coldRecord) + MAXWORD + 3 * MAXLINELENGTH];
+    if (entry->len > (int)sizeof(buffer) || pread(cold->segments[entry->segment].fd, buffer, entry->len, entry->offset) != entry->len){
+        printf(STAG "Error reading [%s] from cold segment [%d]: %s.\n", entry->name, entry->segment, strerror(errno));
+        return -1;
+    }
+    coldRecord *record = (coldRecord *)buffer;
+    char *fields[4] = {obj->name, obj->package.data1, obj->package.data2, obj->package.data3};
+    memset(obj, 0, sizeof(sObject));
+    obj->owner = record->owner;
+    obj->version = record->version;
+    int at = sizeof(coldRecord);
+    for (int f = 0; f < 4; f++){
+        memcpy(fields[f], buffer + at, record->len[f]);
+        at += record->len[f];
+    }
+    cold->fetched++;
+    return 0;
+}
+
+/**
+ * coldDrop
+ * 
+ * Forget a cold object (deleted, replaced, or back in the table); its record
+ * becomes dead space. Linear probing closes the gap by moving later entries
+ * of the run back, so no tombstones are left.
+*/
+void coldDrop(coldStore *cold, const char *name){
+    if (cold == NULL) return;
+    coldEntry *entry = keydirProbe(cold, name);
+    if (entry->name[0] == '\0') return;
+    cold->segments[entry->segment].dead += entry->len;
+
+    unsigned int mask = cold->capacity - 1;
+    unsigned int hole = entry - cold->keydir;
+    for (unsigned int i = (hole + 1) & mask; cold->keydir[i].name[0] != '\0'; i = (i + 1) & mask){
+        unsigned int home = nameHash(cold->keydir[i].name) & mask;
+        //an entry whose home lies cyclically in (hole, i] is where it belongs
+        int stays = (hole < i) ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (stays) continue;
+        cold->keydir[hole] = cold->keydir[i];
+        hole = i;
+    }
+    memset(&cold->keydir[hole], 0, sizeof(coldEntry));
+    cold->count--;
+    cold->dropped++;
+
+    //names dropped stay in the filter until it is rebuilt; they are often the
+    //very names asked for next (a delete, then a get or a fresh put)
+    if (++cold->bloomStale > cold->count / 8 + KEYDIRSTART / 16) bloomBuild(cold);
+}
+
+/**
+ * nameCompare (helper)
+ * 
+ * qsort() comparison of two object names.
+*/
+static int nameCompare(const void *a, const void *b){
+    return strncmp((const char *)a, (const char *)b, MAXWORD);
+}
+
+/**
+ * coldRange
+ * 
+ * Gather the cold names a list request covers (past its cursor, or from
+ * its lower bound), sorted; a scan of the whole key directory.
+ * 
+ * returns how many there are, in *names (free() it), or 0
+*/
+int coldRange(coldStore *cold, listMsg *req, char (**names)[MAXWORD]){
+    *names = NULL;
+    if (cold == NULL || cold->count == 0) return 0;
+    char (*found)[MAXWORD] = malloc(cold->count * sizeof(*found));
+    if (found == NULL) return 0;
+    int n = 0;
+    for (int i = 0; i < cold->capacity; i++){
+        const char *name = cold->keydir[i].name;
+        if (name[0] == '\0') continue;
+        if (req->cursor[0] != '\0' ? strncmp(name, req->cursor, MAXWORD) <= 0 : strncmp(name, req->low, MAXWORD) < 0) continue;
+        if (!listMatch(req, name)) continue;
+        strncpy(found[n++], name, MAXWORD);
+    }
+    qsort(found, n, sizeof(*found), nameCompare);
+    *names = found;
+    return n;
+}
+
+/**
+ * coldCompact
+ * 
+ * Reclaim a mostly dead segment, a few records at a time: copy each record
+ * the key directory still points at to the active segment, and remove the
+ * segment once they have all moved. A segment qualifies once half of it is
+ * dead; the deadest goes first. One that can't be read, or whose records
+ * can't be moved, is left as it is and not tried again.
+ * 
+ * int steps: records to examine this time
+*/
+void coldCompact(coldStore *cold, int steps){
+    if (cold->compacting < 0){
+        long mostDead = 0;
+        for (int seg = 0; seg < MAXSEGMENTS; seg++){
+            coldSegment *candidate = &cold->segments[seg];
+            if (candidate->fd < 0 || candidate->stuck || seg == cold->active || 2 * candidate->dead < candidate->bytes) continue;
+            if (candidate->dead > mostDead){
+                mostDead = candidate->dead;
+                cold->compacting = seg;
+            }
+        }
+        if (cold->compacting < 0) return;
+        cold->compactAt = 0;
+    }
+
+    int from = cold->compacting;
+    coldSegment *seg = &cold->segments[from];
+    int failed = 0;
+    for (; steps > 0 && cold->compactAt < seg->bytes; steps--){
+        char buffer[sizeof(coldRecord) + MAXWORD];
+        coldRecord *record = (coldRecord *)buffer;
+        if (pread(seg->fd, buffer, sizeof(buffer), cold->compactAt) < (ssize_t)sizeof(coldRecord) || record->len[0] > MAXWORD){
+            failed = 1;
+            break;
+        }
+        char name[MAXWORD + 1] = {0};
+        memcpy(name, buffer + sizeof(coldRecord), record->len[0]);
+        int len = sizeof(coldRecord) + record->len[0] + record->len[1] + record->len[2] + record->len[3];
+
+        coldEntry *entry = keydirProbe(cold, name);
+        if (entry->name[0] != '\0' && entry->segment == from && entry->offset == cold->compactAt){
+            sObject obj;
+            if (coldRead(cold, entry, &obj) < 0 || coldAppend(cold, &obj, entry) < 0){
+                failed = 1;
+                break;
+            }
+            cold->fetched--;
+            cold->moved += len;
+        }
+        cold->compactAt += len;
+    }
+    if (failed){
+        //the server would otherwise come straight back to it, never waiting
+        printf(STAG "cold segment [%d]: compaction stopped at offset [%ld]; leaving the segment as it is.\n", from, cold->compactAt);
+        seg->stuck = 1;
+        cold->compacting = -1;
+        return;
+    }
+    if (cold->compactAt < seg->bytes) return;
+
+    char path[PATH_MAX];
+    coldSegmentPath(cold, from, path);
+    close(seg->fd);
+    unlink(path);
+    seg->fd = -1;
+    cold->compacting = -1;
+    cold->compactions++;
+}
+
+/**
+ * coldStats
+ * 
+ * Add the cold tier's counters to a stats report: what it holds, what the
+ * Bloom filter saved, and what compaction has reclaimed.
+*/
+void coldStats(coldStore *cold, statsReport *report){
+    long bytes = 0, dead = 0;
+    int nSegments = 0;
+    for (int seg = 0; seg < MAXSEGMENTS; seg++){
+        if (cold->segments[seg].fd < 0) continue;
+        nSegments++;
+        bytes += cold->segments[seg].bytes;
+        dead += cold->segments[seg].dead;
+    }
+    statsLine(report, "cold: objects [%d], segments [%d], [%ld] bytes, [%ld] dead", cold->count, nSegments, bytes, dead);
+    statsLine(report, "cold: spilled [%ld], read back [%ld], dropped [%ld]", cold->spilled, cold->fetched, cold->dropped);
+    statsLine(report, "cold bloom: skipped [%ld], false hits [%ld]", cold->bloomSkips, cold->falseHits);
+    statsLine(report, "cold compactions [%ld], moved [%ld] bytes", cold->compactions, cold->moved);
+}
+
+/**
+ * statsLine
+ * 
+ * printf-style: append one line to a stats report (dropped if it's full).
+*/
+void statsLine(statsReport *report, const char *format, ...){
+    if (report->n >= MAXSTATLINES) return;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(report->lines[report->n++], MAXLINELENGTH, format, args);
+    va_end(args);
+}
+
+/**
+ * tableStats
+ * 
+ * Add the object table's counters to a stats report.
+*/
+void tableStats(sTable *table, statsReport *report){
+    long gets = table->hits + table->misses;
+    statsLine(report, "objects [%d/%d], resident [%ld] bytes, budget [%ld] bytes",
+        table->count, table->size, table->residentBytes, table->budget);
+    statsLine(report, "gets [%ld]: hits [%ld], misses [%ld], hit rate [%.1f%%]",
+        gets, table->hits, table->misses, gets ? 100.0 * table->hits / gets : 0.0);
+    statsLine(report, "evictions [%ld]", table->evictions);
+}
+
+/**
+ * serverStats
+ * 
+ * Send a stats report: an ack whose argument is the number of stats frames
+ * that follow, then the report three lines per frame, queued together.
+ * 
+ * returns the number of stats frames sent
+*/
+int serverStats(cliState *cli, statsReport *report){
+    int nFrames = (report->n + 2) / 3;
+    FRAME reply[MAXSTATLINES / 3 + 2];
+    memset(reply, 0, sizeof(reply));
+
+    reply[0].kind = ack;
+    reply[0].data = packIntM(0, stats, nFrames);
+    for (int f = 0; f < nFrames; f++){
+        const char *l1 = report->lines[3*f];
+        const char *l2 = (3*f + 1 < report->n) ? report->lines[3*f + 1] : "";
+        const char *l3 = (3*f + 2 < report->n) ? report->lines[3*f + 2] : "";
+        reply[f + 1].kind = stats;
+        reply[f + 1].data = packStrM(l1, l2, l3);
+    }
+    for (int l = 0; l < report->n; l++) printf(STAG "STATS: %s\n", report->lines[l]);
+
+    if (serverReply(cli, reply, nFrames + 1) != nFrames + 1){
+        printf("serverStats error: client [%d] reply queue full\n", cli->id);
+    }
+    return nFrames;
+}
+
+/**
+ * serverRequest
+ * 
+ * Carry out one client request against the server state and send the
+ * replies to that client's server-to-client fifo.
+ * 
+ * serverState *srv: the server's table, clients and counters
+ * cliState *cli: the client that sent the request
+ * FRAME *frame: the request
+*/
+void serverRequest(serverState *srv, cliState *cli, FRAME *frame){
+
+    //process client req's:
+    sObject cliObj;
+    memset(&cliObj, 0, sizeof(cliObj));
+
+    sObject servObj;
+    memset(&servObj, 0, sizeof(servObj));
+
+    srv->requests++;
+    cli->seq = frame->seq;
+    cli->noReply = (frame->flags & FR_NOREPLY) && (frame->kind == put || frame->kind == delete);
+    if (cli->noReply) cli->silent++;
+
+    // =======================================================================
+    // SERVER RESPONSES TO CLIENT REQUESTS
+    // =======================================================================
+    switch(frame->kind){
+
+        //
+        // PUT
+        //
+        case (put):;
+            cliObj = frame->data.package.mObj;
+            int putResult = srv->replica ? st_readonly : tableSet(&srv->table, &cliObj, cliObj.version);
+            if (putResult >= 0) leaseRevoke(srv, cliObj.name, putResult);
+            serverACK(cli, put, putResult);
+            if (putResult < 0){
+                printf(STAG "PUT error: [%s] %s.\n", cliObj.name, statusList[-putResult]);
+                break;
+            }
+            watchPublish(srv, put, cliObj.name, putResult);
+            int index = tableFind(&srv->table, cliObj.name);
+            if (srv->replLog != NULL) replPublish(srv, put, &srv->table.objects[index]);
+            printf(STAG "PUT at loc [%d]:\n\
+NAME: \t[%s]\n\
+OWNR: \t[%d]\n\
+VERS: \t[%d]\n\
+LOAD: [%s], [%s], [%s]\n",
+            index,
+            srv->table.objects[index].name,
+            srv->table.objects[index].owner,
+            srv->table.objects[index].version,
+            srv->table.objects[index].package.data1,
+            srv->table.objects[index].package.data2,
+            srv->table.objects[index].package.data3);
+            break;
+
+        //
+        // GET
+        //
+        case (get):;
+            cliObj = frame->data.package.mObj;
+            if (serverGet(cli, &srv->table, cliObj.name) < 0){
+                printf(STAG "GET error: object [%s] not found in server table.\n", cliObj.name);
+            }
+            else if (cli->leaseMs > 0) leaseGrant(cli, cliObj.name);
+            break;
+
+        //
+        // DELETE
+        //
+        case (delete):;
+            cliObj = frame->data.package.mObj;
+            int delResult = srv->replica ? st_readonly : tableRemove(&srv->table, cliObj.name, cliObj.version);
+            if (delResult >= 0) leaseRevoke(srv, cliObj.name, delResult);
+            serverACK(cli, delete, delResult);
+            if (delResult >= 0){
+                watchPublish(srv, delete, cliObj.name, delResult);
+                cliObj.version = delResult;
+                if (srv->replLog != NULL) replPublish(srv, delete, &cliObj);
+                printf(STAG "deleting [%s] version [%d] from table; this is final!\n", cliObj.name, delResult);
+                break;
+            }
+            printf(STAG "DELETE error: [%s] %s. Could not delete.\n", cliObj.name, statusList[-delResult]);
+            break;
+
+        //
+        // LIST
+        //
+        case (list):;
+            serverACK(cli, list, st_ok);
+            int nListed = serverList(cli, &srv->table, &frame->data.package.mList);
+            printf(STAG "LIST: sent [%d] names.\n", nListed);
+            break;
+
+        //
+        // GTIME
+        //
+        case (gtime):;
+            DATA timeData;
+            memset(&timeData, 0, sizeof(timeData));
+            time_t currTime = time(NULL);
+            time_t elapsed = currTime - srv->startTime;
+            timeData = packIntM(0, gtime, elapsed);
+            FRAME timeF = initFrame();
+            timeF.kind = stime;
+            timeF.data = timeData;
+            serverReply(cli, &timeF, 1);
+            printf(STAG "send elapsed time [%d sec.]\n", elapsed);
+            break;
+        
+        //
+        // DELAY
+        //
+        case (delay):;
+            serverACK(cli, delay, st_ok);
+            break;
+        
+        //
+        // STATS
+        //
+        case (stats):;
+            statsReport report;
+            memset(&report, 0, sizeof(report));
+            tableStats(&srv->table, &report);
+            replyStats(srv, &report);
+            schedStats(srv, &report);
+            if (srv->uring != NULL) uringStats(srv, &report);
+            if (srv->spinMaxUs > 0) spinStats(srv, &report);
+            if (srv->table.cold != NULL) coldStats(srv->table.cold, &report);
+            if (srv->capture != NULL) statsLine(&report, "capture: [%ld] requests, [%ld] bytes", srv->captured, srv->captureBytes);
+            if (srv->replPath != NULL) replStats(srv, &report);
+            serverStats(cli, &report);
+            break;
+
+        //
+        // WATCH / UNWATCH
+        //
+        case (watch):;
+            int watchResult = watchAdd(cli, frame->data.package.mObj.name);
+            serverACK(cli, watch, watchResult);
+            printf(STAG "client [%d] watching [%s*]: %s.\n", cli->id, frame->data.package.mObj.name, statusList[-watchResult]);
+            break;
+
+        case (unwatch):;
+            int unwatchResult = watchRemove(cli, frame->data.package.mObj.name);
+            serverACK(cli, unwatch, unwatchResult);
+            break;
+
+        //
+        // LEASE
+        //
+        case (lease):;
+            //a caching client asks for read leases of this many ms on its gets
+            cli->leaseMs = frame->data.package.mInt.argument;
+            if (cli->leaseMs > srv->maxLeaseMs) cli->leaseMs = srv->maxLeaseMs;
+            if (cli->leaseMs < 0) cli->leaseMs = 0;
+            memset(cli->leases, 0, sizeof(cli->leases));
+            serverACK(cli, lease, cli->leaseMs);
+            printf(STAG "client [%d] gets [%d] ms leases.\n", cli->id, cli->leaseMs);
+            break;
+
+        //
+        // QUIT
+        //
+        case (quit):;
+            //a client that quits stops watching and caching; drop anything still queued for it
+            cli->nWatch = 0;
+            cli->nNotify = 0;
+            cli->dropped = 0;
+            cli->leaseMs = 0;
+            memset(cli->leases, 0, sizeof(cli->leases));
+            serverACK(cli, quit, st_ok);
+            printf(STAG "client [%d] quit!\n", cli->id);
+            break;
+
+        default:
+            serverACK(cli, frame->kind, st_ok);
+            break;
+    } // end of switch cases for server responses;
+}
+
+/**
+ * framePrio
+ * 
+ * returns the scheduling class of a request: puts and deletes are writes,
+ * gets and lists reads, and everything else (gtime, stats, quit, ...) control
+*/
+PRIO framePrio(KIND kind){
+    switch (kind){
+        case put:
+        case delete:
+            return pr_write;
+        case get:
+        case list:
+            return pr_read;
+        default:
+            return pr_control;
+    }
+}
+
+/**
+ * serverReadAhead
+ * 
+ * Read as many requests as a client has sent, up to the room in its
+ * read-ahead queue, in one read. A read may end partway through a request
+ * (a writev of several frames is not atomic past PIPE_BUF); its bytes wait
+ * for the rest in the next read.
+ * 
+ * returns the number of requests queued
+*/
+int serverReadAhead(serverState *srv, cliState *cli){
+    int before = cli->nIn;
+    char bytes[INQUEUE * sizeof(FRAME)];
+    ssize_t nread = read(cli->inFD, bytes, (INQUEUE - cli->nIn) * sizeof(FRAME) - cli->inPartHave);
+    if (nread <= 0){
+        printf(STAG "client [%d] read: %s.\n", cli->id, nread == 0 ? "end of file" : strerror(errno));
+        return 0;
+    }
+
+    serverTake(srv, cli, bytes, nread);
+    return cli->nIn - before;
+}
+
+/**
+ * serverTake
+ * 
+ * Queue the requests in len bytes read from a client, finishing first the
+ * one an earlier read stopped partway through, and keep the bytes of a
+ * request that is still partial after them. Stops when the read-ahead
+ * queue is full.
+ * 
+ * returns the number of bytes used
+*/
+size_t serverTake(serverState *srv, cliState *cli, const char *bytes, size_t len){
+    FRAME frames[INQUEUE];
+    int n = 0;
+    size_t used = 0;
+    while (cli->nIn + n < INQUEUE && used < len){
+        if (cli->inPartHave == 0 && len - used >= sizeof(FRAME)){
+            memcpy(&frames[n++], bytes + used, sizeof(FRAME));
+            used += sizeof(FRAME);
+            continue;
+        }
+        size_t take = sizeof(FRAME) - cli->inPartHave;
+        if (take > len - used) take = len - used;
+        memcpy((char *)&cli->inPart + cli->inPartHave, bytes + used, take);
+        cli->inPartHave += take;
+        used += take;
+        if (cli->inPartHave == sizeof(FRAME)){
+            frames[n++] = cli->inPart;
+            cli->inPartHave = 0;
+        }
+    }
+
+    serverEnqueue(srv, cli, frames, n);
+    return used;
+}
+
+/**
+ * serverEnqueue
+ * 
+ * Add n requests just read to a client's read-ahead queue, which has room,
+ * and to the capture if there is one.
+*/
+void serverEnqueue(serverState *srv, cliState *cli, FRAME *frames, int n){
+    long now = monotonicUs();
+    for (int f = 0; f < n; f++){
+        printFrame(STAG "got client data from fd", &frames[f]);
+        if (srv->capture != NULL) captureFrame(srv, cli, &frames[f], now);
+        int tail = (cli->inHead + cli->nIn) % INQUEUE;
+        cli->inQ[tail] = frames[f];
+        cli->inAt[tail] = now;
+        cli->nIn++;
+    }
+}
+
+/**
+ * schedNext
+ * 
+ * Pick the client whose oldest queued request should be served next:
+ * the one with the earliest start tag, its virtual time (never behind the
+ * server's) less its request's class head start. Clients over the reply
+ * high-water mark wait.
+ * 
+ * returns the client, or NULL if nothing can be served
+*/
+cliState *schedNext(serverState *srv){
+    cliState *best = NULL;
+    double bestTag = 0;
+    for (int c = 0; c < NCLIENT; c++){
+        cliState *cli = &srv->clients[c];
+        if (cli->nIn == 0 || cli->replies.n >= REPLYHIGHWATER) continue;
+        double start = (cli->vtime > srv->vtime) ? cli->vtime : srv->vtime;
+        double tag = start - prioLead[framePrio(cli->inQ[cli->inHead].kind)];
+        if (best == NULL || tag < bestTag){
+            best = cli;
+            bestTag = tag;
+        }
+    }
+    return best;
+}
+
+/**
+ * schedServe
+ * 
+ * Serve up to SERVEBATCH queued requests in fair order, charging each
+ * client virtual time for its request's class over its weight.
+*/
+void schedServe(serverState *srv){
+    cliState *cli;
+    for (int n = 0; n < SERVEBATCH && (cli = schedNext(srv)) != NULL; n++){
+        FRAME request = cli->inQ[cli->inHead];
+        long waited = monotonicUs() - cli->inAt[cli->inHead];
+        cli->inHead = (cli->inHead + 1) % INQUEUE;
+        cli->nIn--;
+
+        //nobody is waiting for the reply any more; skip the work and stay unanswered
+        PRIO prio = framePrio(request.kind);
+        long late = (request.deadline > 0) ? monotonicMs() - request.deadline : 0;
+        if (late > 0){
+            srv->expired[prio]++;
+            printf(STAG "client [%d] %s seq [%d] expired [%ld] ms ago; dropped.\n", cli->id, commandList[request.kind], request.seq, late);
+            continue;
+        }
+        double start = (cli->vtime > srv->vtime) ? cli->vtime : srv->vtime;
+        srv->vtime = start;
+        cli->vtime = start + prioCost[prio] / cli->weight;
+
+        srv->served[prio]++;
+        srv->waitUs[prio] += waited;
+        if (waited > srv->maxWaitUs[prio]) srv->maxWaitUs[prio] = waited;
+        serverRequest(srv, cli, &request);
+    }
+}
+
+/**
+ * schedStats
+ * 
+ * Add, for each scheduling class, how many requests were served or dropped
+ * past their deadline, and how long they waited between being read and
+ * being served.
+*/
+void schedStats(serverState *srv, statsReport *report){
+    for (int p = 0; p < NPRIO; p++){
+        statsLine(report, "%s: served [%ld], expired [%ld], wait avg [%ld] us, max [%ld] us", prioList[p], srv->served[p],
+            srv->expired[p], srv->served[p] ? srv->waitUs[p] / srv->served[p] : 0, srv->maxWaitUs[p]);
+    }
+}
+
+/**
+ * serverOpenClient
+ * 
+ * Open (creating them if needed) the fifo pair for client id in dir:
+ * fifo-id-0 for its requests and fifo-0-id for replies.
+ * Both ends are opened read/write so neither blocks waiting for the client,
+ * and the reply end is non-blocking: queueWrite() writes what fits.
+ * With pipeSize > 0 both fifos are resized to it.
+ * 
+ * returns 0, or -1 if a fifo could not be opened
+*/
+int serverOpenClient(cliState *cli, int id, const char *dir, int pipeSize){
+    char fifoCtoS[MAXLINE];
+    char fifoStoC[MAXLINE];
+    snprintf(fifoCtoS, sizeof(fifoCtoS), "%s/fifo-%d-0", dir, id);
+    snprintf(fifoStoC, sizeof(fifoStoC), "%s/fifo-0-%d", dir, id);
+
+    memset(cli, 0, sizeof(cliState));
+    cli->id = id;
+    cli->replies.frames = cli->replyBuffer;
+    cli->replies.size = REPLYQUEUE;
+
+    if (mkfifo(fifoCtoS, 0666) < 0 && errno != EEXIST){
+        printf(STAG "Error creating [%s]: %s.\n", fifoCtoS, strerror(errno));
+    }
+    if (mkfifo(fifoStoC, 0666) < 0 && errno != EEXIST){
+        printf(STAG "Error creating [%s]: %s.\n", fifoStoC, strerror(errno));
+    }
+
+    cli->inFD = open(fifoCtoS, O_RDWR);
+    if (cli->inFD < 0){
+        printf(STAG "Error opening [%s]: %s.\n", fifoCtoS, strerror(errno));
+        return -1;
+    } else printf(STAG "open c|s fifo %s, %d\n", fifoCtoS, cli->inFD);
+
+    cli->outFD = open(fifoStoC, O_RDWR | O_NONBLOCK);
+    if (cli->outFD < 0){
+        printf(STAG "Error opening [%s]: %s.\n", fifoStoC, strerror(errno));
+        return -1;
+    } else printf(STAG "open s|c fifo %s, %d\n", fifoStoC, cli->outFD);
+
+    if (pipeSize > 0){
+        if (fcntl(cli->inFD, F_SETPIPE_SZ, pipeSize) < 0 || fcntl(cli->outFD, F_SETPIPE_SZ, pipeSize) < 0){
+            printf(STAG "Error resizing fifos for client [%d] to [%d] bytes: %s.\n", id, pipeSize, strerror(errno));
+        }
+        else printf(STAG "fifos for client [%d] hold [%d] bytes.\n", id, fcntl(cli->outFD, F_GETPIPE_SZ));
+    }
+    return 0;
+}
+
+/**
+ * queuePush
+ * 
+ * Queue n frames behind anything already waiting. Nothing is written
+ * until queueWrite().
+ * 
+ * returns the number of frames queued: fewer than n only if the queue filled
+*/
+int queuePush(frameQueue *queue, FRAME *frames, int n){
+    int queued = 0;
+    for (; queued < n && queue->n < queue->size; queued++){
+        queue->frames[(queue->head + queue->n) % queue->size] = frames[queued];
+        queue->n++;
+    }
+    if (queue->n > queue->peak) queue->peak = queue->n;
+    return queued;
+}
+
+/**
+ * serverReply
+ * 
+ * Queue a client's reply frames, tagged with the sequence number of the
+ * request they answer; a request that asked for no reply gets none.
+ * 
+ * returns the number queued (or dropped as unwanted)
+*/
+int serverReply(cliState *cli, FRAME *frames, int n){
+    if (cli->noReply){
+        if (frames[0].kind == ack && frames[0].data.package.mInt.argument < 0) cli->silentFailed++;
+        return n;
+    }
+    for (int f = 0; f < n; f++) frames[f].seq = cli->seq;
+    return queuePush(&cli->replies, frames, n);
+}
+
+/**
+ * queueWrite
+ * 
+ * Write as much of a queue as fd takes right now, in one writev (two
+ * pieces when the ring wraps). A frame cut short by a full fifo or socket
+ * is finished on a later call, so frames always arrive whole.
+ * 
+ * returns the number of frames still queued, or -1 if fd is broken
+*/
+int queueWrite(frameQueue *queue, int fd){
+    if (queue->n == 0) return 0;
+
+    struct iovec pieces[2];
+    int nPieces = queueSpan(queue, pieces);
+    ssize_t nwrote = writev(fd, pieces, nPieces);
+    if (nwrote < 0){
+        if (errno == EAGAIN || errno == EINTR) return queue->n;
+        printf("queueWrite error: %s on fd %d\n", strerror(errno), fd);
+        return -1;
+    }
+    queueAdvance(queue, nwrote);
+    return queue->n;
+}
+
+/**
+ * queueSpan
+ * 
+ * Describe the unwritten part of a queue as one iovec, or two when the
+ * ring wraps. The frames stay put until queueAdvance(): pushes only add
+ * behind them.
+ * 
+ * returns the number of pieces
+*/
+int queueSpan(frameQueue *queue, struct iovec pieces[2]){
+    int nPieces = 0;
+    int first = (queue->head + queue->n <= queue->size) ? queue->n : queue->size - queue->head;
+    pieces[nPieces].iov_base = (char *)&queue->frames[queue->head] + queue->sent;
+    pieces[nPieces++].iov_len = first * sizeof(FRAME) - queue->sent;
+    if (first < queue->n){
+        pieces[nPieces].iov_base = queue->frames;
+        pieces[nPieces++].iov_len = (queue->n - first) * sizeof(FRAME);
+    }
+    return nPieces;
+}
+
+/**
+ * queueAdvance
+ * 
+ * Drop the frames nwrote bytes finished from the front of a queue,
+ * remembering how far into the next one the write got.
+*/
+void queueAdvance(frameQueue *queue, size_t nwrote){
+    size_t done = queue->sent + nwrote;
+    int nDone = done / sizeof(FRAME);
+    queue->head = (queue->head + nDone) % queue->size;
+    queue->n -= nDone;
+    queue->sent = done % sizeof(FRAME);
+}
+
+/**
+ * uringOpen
+ * 
+ * Set up an io_uring and map its rings, then register a ring of URINGBUFS
+ * provided buffers for each client (buffer group = client index) for its
+ * multishot read to fill. With sqpoll a kernel thread picks up submissions.
+ * 
+ * returns 0, or -1 with errno set
+*/
+int uringOpen(uringLoop *ring, int sqpoll){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (sqpoll){
+        params.flags = IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = URINGIDLE;
+    }
+    memset(ring, 0, sizeof(uringLoop));
+    ring->sqpoll = sqpoll;
+    ring->fd = syscall(__NR_io_uring_setup, URINGENTRIES, &params);
+    if (ring->fd < 0) return -1;
+    if (!(params.features & IORING_FEAT_EXT_ARG)){
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP){
+        if (cqSize > sqSize) sqSize = cqSize;
+    }
+    char *sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) return -1;
+    char *cq = sq;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)){
+        cq = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) return -1;
+    }
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) return -1;
+
+    ring->sqEntries = params.sq_entries;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqFlags = (unsigned *)(sq + params.sq_off.flags);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    ring->bufs = malloc((size_t)NCLIENT * URINGBUFS * URINGBUFLEN);
+    if (ring->bufs == NULL) return -1;
+    for (int c = 0; c < NCLIENT; c++){
+        //the buffer ring must be page aligned
+        ring->bufRing[c] = mmap(NULL, URINGBUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring->bufRing[c] == MAP_FAILED) return -1;
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (unsigned long)ring->bufRing[c];
+        reg.ring_entries = URINGBUFS;
+        reg.bgid = c;
+        if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -1;
+        for (int b = 0; b < URINGBUFS; b++) uringRecycle(ring, c, b);
+    }
+    return 0;
+}
+
+/**
+ * uringSqe
+ * 
+ * returns the next free submission entry, cleared, or NULL if the queue is
+ * full; it isn't seen by the kernel until uringQueue().
+*/
+struct io_uring_sqe *uringSqe(uringLoop *ring){
+    unsigned tail = *ring->sqTail;
+    if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->sqEntries) return NULL;
+    struct io_uring_sqe *sqe = &ring->sqes[tail & *ring->sqMask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqArray[tail & *ring->sqMask] = tail & *ring->sqMask;
+    return sqe;
+}
+
+/**
+ * uringQueue
+ * 
+ * Publish the entry uringSqe() handed out; it goes in with the next
+ * io_uring_enter (or straight away, to the sqpoll thread).
+*/
+void uringQueue(uringLoop *ring){
+    __atomic_store_n(ring->sqTail, *ring->sqTail + 1, __ATOMIC_RELEASE);
+    ring->toSubmit++;
+    ring->submitted++;
+}
+
+/**
+ * uringWakeup
+ * 
+ * The io_uring_enter flag that wakes an sqpoll thread gone idle, if it has.
+ * The flag is read after the tail was published, a store then a load, so
+ * it takes a full barrier; otherwise the read can see the thread still
+ * awake, and the entries just queued wait for nothing.
+ * 
+ * returns IORING_ENTER_SQ_WAKEUP or 0
+*/
+unsigned uringWakeup(uringLoop *ring){
+    if (!ring->sqpoll) return 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return (__atomic_load_n(ring->sqFlags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) ? IORING_ENTER_SQ_WAKEUP : 0;
+}
+
+/**
+ * uringRecycle
+ * 
+ * Give a client's buffer back to its provided-buffer ring to be read into.
+*/
+void uringRecycle(uringLoop *ring, int c, int bid){
+    struct io_uring_buf *buf = &ring->bufRing[c]->bufs[ring->bufTail[c] & (URINGBUFS - 1)];
+    buf->addr = (unsigned long)(ring->bufs + ((size_t)c * URINGBUFS + bid) * URINGBUFLEN);
+    buf->len = URINGBUFLEN;
+    buf->bid = bid;
+    ring->bufTail[c]++;
+    __atomic_store_n(&ring->bufRing[c]->tail, ring->bufTail[c], __ATOMIC_RELEASE);
+}
+
+/**
+ * uringFeed
+ * 
+ * Move requests from a client's filled buffers into its read-ahead queue
+ * while it has room, recycling each buffer once it is used up; a request
+ * split across two buffers is put back together (serverTake).
+*/
+void uringFeed(serverState *srv, int c){
+    uringLoop *ring = srv->uring;
+    cliState *cli = &srv->clients[c];
+    while (ring->nFilled[c] > 0 && cli->nIn < INQUEUE){
+        uringBuf *buf = &ring->filled[c][0];
+        const char *bytes = ring->bufs + ((size_t)c * URINGBUFS + buf->bid) * URINGBUFLEN;
+        buf->off += serverTake(srv, cli, bytes + buf->off, buf->len - buf->off);
+        if (buf->off == buf->len){
+            uringRecycle(ring, c, buf->bid);
+            memmove(&ring->filled[c][0], &ring->filled[c][1], --ring->nFilled[c] * sizeof(uringBuf));
+        }
+    }
+}
+
+/**
+ * uringReap
+ * 
+ * Handle every completion waiting: a read hands its client a filled buffer
+ * (its multishot stops when the client's buffers run out, and is re-armed
+ * once some are recycled); a write drops what it wrote from the client's
+ * reply queue, and a short or refused one waits for POLLOUT first.
+*/
+void uringReap(serverState *srv){
+    uringLoop *ring = srv->uring;
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++){
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+        int c = cqe->user_data & 0xff;
+        cliState *cli = &srv->clients[c];
+        ring->completed++;
+        switch (cqe->user_data >> 8){
+            case ur_read:
+                if (!(cqe->flags & IORING_CQE_F_MORE)) ring->reading[c] = 0;
+                if (cqe->flags & IORING_CQE_F_BUFFER){
+                    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    if (cqe->res > 0){
+                        printf(STAG "fd %d read [%d] bytes.\n", cli->inFD, cqe->res);
+                        ring->filled[c][ring->nFilled[c]++] = (uringBuf){bid, cqe->res, 0};
+                        ring->reads++;
+                        ring->readBytes += cqe->res;
+                    }
+                    else uringRecycle(ring, c, bid);
+                }
+                else if (cqe->res < 0 && cqe->res != -ENOBUFS){
+                    printf(STAG "client [%d] read error: %s.\n", cli->id, strerror(-cqe->res));
+                }
+                break;
+            case ur_write:
+                ring->writing[c] = 0;
+                ring->writes++;
+                if (cqe->res >= 0) queueAdvance(&cli->replies, cqe->res);
+                else if (cqe->res != -EAGAIN) printf("queueWrite error: %s on fd %d\n", strerror(-cqe->res), cli->outFD);
+                if (cqe->res == -EAGAIN || (cqe->res >= 0 && (size_t)cqe->res < ring->writeLen[c])){
+                    struct io_uring_sqe *sqe = uringSqe(ring);
+                    if (sqe == NULL) break;
+                    sqe->opcode = IORING_OP_POLL_ADD;
+                    sqe->fd = cli->outFD;
+                    sqe->poll32_events = POLLOUT;
+                    sqe->user_data = (ur_pollout << 8) | c;
+                    uringQueue(ring);
+                    ring->waitingOut[c] = 1;
+                }
+                break;
+            case ur_pollout:
+                ring->waitingOut[c] = 0;
+                break;
+        }
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * uringWait
+ * 
+ * The io_uring backend's poll(): arm a multishot read for every client
+ * ready for more requests, then in one io_uring_enter submit everything
+ * queued (the round's reply writes too) and wait up to waitMs for a
+ * completion, and handle what completed. With sqpoll nothing needs
+ * submitting, so a round with requests to serve makes no system call.
+ * 
+ * returns the number of completions, or -1 on error
+*/
+int uringWait(serverState *srv, int waitMs){
+    uringLoop *ring = srv->uring;
+    for (int c = 0; c < NCLIENT; c++){
+        cliState *cli = &srv->clients[c];
+        uringFeed(srv, c);
+        if (cli->nIn > 0 && cli->replies.n < REPLYHIGHWATER) waitMs = 0;
+        if (ring->reading[c] || ring->nFilled[c] == URINGBUFS || cli->replies.n >= REPLYHIGHWATER) continue;
+        struct io_uring_sqe *sqe = uringSqe(ring);
+        if (sqe == NULL) break;
+        sqe->opcode = URING_READ_MULTISHOT;
+        sqe->fd = cli->inFD;
+        sqe->off = -1;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = c;
+        sqe->user_data = (ur_read << 8) | c;
+        uringQueue(ring);
+        ring->reading[c] = 1;
+    }
+
+    unsigned flags = uringWakeup(ring);
+    struct __kernel_timespec timeout = {.tv_sec = waitMs / 1000, .tv_nsec = (waitMs % 1000) * 1000000L};
+    struct io_uring_getevents_arg arg = {.ts = (unsigned long)&timeout};
+    if (waitMs > 0) flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    int toSubmit = ring->sqpoll ? 0 : ring->toSubmit;
+    long before = ring->completed;
+    if (flags != 0 || toSubmit > 0){
+        ring->enters++;
+        if (syscall(__NR_io_uring_enter, ring->fd, toSubmit, (waitMs > 0) ? 1 : 0, flags, &arg, sizeof(arg)) < 0 && errno != ETIME && errno != EINTR){
+            return -1;
+        }
+    }
+    ring->toSubmit = 0;
+
+    uringReap(srv);
+    for (int c = 0; c < NCLIENT; c++) uringFeed(srv, c);
+    return ring->completed - before;
+}
+
+/**
+ * serverPoll
+ * 
+ * Wait up to waitMs for client fifo or replication events, with whichever
+ * backend the server runs.
+ * 
+ * returns the number of events, or -1 on error
+*/
+int serverPoll(serverState *srv, int waitMs){
+    if (srv->uring != NULL) return uringWait(srv, waitMs);
+    return poll(srv->pollFDs, NPOLL, waitMs);
+}
+
+/**
+ * serverWait
+ * 
+ * Wait up to waitMs for events; in busy-poll mode (-B) first spin on
+ * non-blocking checks for up to the current budget, then sleep for the rest.
+ * The budget follows the gaps between requests: a sleep that ended within
+ * spinMaxUs doubles it (a spin that long would have caught the request), a
+ * longer one halves it, down to no spinning at all.
+ * 
+ * returns the number of events, or -1 on error
+*/
+int serverWait(serverState *srv, int waitMs){
+    if (srv->spinMaxUs <= 0 || waitMs == 0) return serverPoll(srv, waitMs);
+
+    long start = monotonicUs();
+    long budget = srv->spinUs;
+    if (budget > waitMs * 1000L) budget = waitMs * 1000L;
+    if (budget > 0){
+        int ready = 0;
+        long now = start;
+        srv->spins++;
+        while (ready == 0 && now - start < budget){
+            ready = serverPoll(srv, 0);
+            now = monotonicUs();
+        }
+        srv->spunUs += now - start;
+        if (ready != 0){
+            if (ready > 0) srv->spinHits++;
+            return ready;
+        }
+        waitMs -= (now - start + 999) / 1000;
+        if (waitMs <= 0) return 0;
+    }
+
+    srv->sleeps++;
+    int ready = serverPoll(srv, waitMs);
+    long waited = monotonicUs() - start;
+    if (ready > 0 && waited <= srv->spinMaxUs){
+        srv->sleepShort++;
+        srv->spinUs = (srv->spinUs < SPINSTART) ? SPINSTART : 2 * srv->spinUs;
+        if (srv->spinUs > srv->spinMaxUs) srv->spinUs = srv->spinMaxUs;
+    }
+    else if (waited > srv->spinMaxUs){
+        srv->spinUs /= 2;
+        if (srv->spinUs < SPINSTART) srv->spinUs = 0;
+    }
+    return ready;
+}
+
+/**
+ * spinStats
+ * 
+ * Add the busy-poll counters to a stats report: the budget now, how often
+ * spinning found work before the server had to sleep, and what it cost.
+*/
+void spinStats(serverState *srv, statsReport *report){
+    statsLine(report, "busy-poll: budget [%ld/%ld] us, spins [%ld], hits [%ld]",
+        srv->spinUs, srv->spinMaxUs, srv->spins, srv->spinHits);
+    statsLine(report, "busy-poll: spun [%ld] ms, sleeps [%ld], within cap [%ld]", srv->spunUs / 1000, srv->sleeps, srv->sleepShort);
+}
+
+/**
+ * uringWrite
+ * 
+ * Queue a writev of everything in a client's reply queue, unless one is
+ * already in flight or its fifo is full; it is submitted with the next
+ * uringWait().
+*/
+void uringWrite(uringLoop *ring, cliState *cli, int c){
+    if (cli->replies.n == 0 || ring->writing[c] || ring->waitingOut[c]) return;
+    struct io_uring_sqe *sqe = uringSqe(ring);
+    if (sqe == NULL) return;
+    int nPieces = queueSpan(&cli->replies, ring->iov[c]);
+    ring->writeLen[c] = 0;
+    for (int p = 0; p < nPieces; p++) ring->writeLen[c] += ring->iov[c][p].iov_len;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = cli->outFD;
+    sqe->addr = (unsigned long)ring->iov[c];
+    sqe->len = nPieces;
+    sqe->off = -1;
+    sqe->user_data = (ur_write << 8) | c;
+    uringQueue(ring);
+    ring->writing[c] = 1;
+}
+
+/**
+ * uringSettle
+ * 
+ * Wait for a client's reply write in flight to complete, so its queue can
+ * be written directly; an idle sqpoll thread is woken to submit it.
+*/
+void uringSettle(serverState *srv, int c){
+    uringLoop *ring = srv->uring;
+    while (ring->writing[c]){
+        struct __kernel_timespec timeout = {.tv_sec = 0, .tv_nsec = 100000000L};
+        struct io_uring_getevents_arg arg = {.ts = (unsigned long)&timeout};
+        int toSubmit = ring->sqpoll ? 0 : ring->toSubmit;
+        ring->enters++;
+        syscall(__NR_io_uring_enter, ring->fd, toSubmit, 1, uringWakeup(ring) | IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        ring->toSubmit = 0;
+        uringReap(srv);
+    }
+}
+
+/**
+ * uringStats
+ * 
+ * Add the io_uring backend's counters to a stats report: system calls,
+ * entries submitted and completed, and how much each read brought in.
+*/
+void uringStats(serverState *srv, statsReport *report){
+    uringLoop *ring = srv->uring;
+    statsLine(report, "io_uring%s: enters [%ld], sqes [%ld], cqes [%ld]", ring->sqpoll ? " (sqpoll)" : "", ring->enters, ring->submitted, ring->completed);
+    statsLine(report, "io_uring reads [%ld], avg [%ld] bytes; writes [%ld]", ring->reads, ring->reads ? ring->readBytes / ring->reads : 0, ring->writes);
+}
+
+/**
+ * replyStats
+ * 
+ * Add each client's reply queue depth, its peak, how often its requests were
+ * paused, its fifo fill and its writes sent without a reply to a stats
+ * report, two lines a client to stay within a line's MAXLINELENGTH.
+*/
+void replyStats(serverState *srv, statsReport *report){
+    for (int c = 0; c < NCLIENT; c++){
+        cliState *cli = &srv->clients[c];
+        int pipeSize = fcntl(cli->outFD, F_GETPIPE_SZ);
+        int inPipe = 0;
+        ioctl(cli->outFD, FIONREAD, &inPipe);
+        statsLine(report, "client [%d]: replies [%d], peak [%d], notifies [%d], paused [%ld]",
+            cli->id, cli->replies.n, cli->replies.peak, cli->nNotify, cli->paused);
+        statsLine(report, "client [%d]: fifo [%d/%d], unacked [%ld], failed [%ld]", cli->id, inPipe, pipeSize, cli->silent, cli->silentFailed);
+    }
+}
+
+/**
+ * watchAdd
+ * 
+ * Add prefix to the names a client watches ("" watches everything).
+ * 
+ * returns st_ok, or st_full if the client already watches MAXWATCH prefixes
+*/
+int watchAdd(cliState *cli, const char *prefix){
+    for (int w = 0; w < cli->nWatch; w++){
+        if (strncmp(cli->watch[w], prefix, MAXWORD) == 0) return st_ok;
+    }
+    if (cli->nWatch == MAXWATCH) return st_full;
+    strncpy(cli->watch[cli->nWatch++], prefix, MAXWORD);
+    return st_ok;
+}
+
+/**
+ * watchRemove
+ * 
+ * returns st_ok, or st_notfound if the client wasn't watching prefix
+*/
+int watchRemove(cliState *cli, const char *prefix){
+    for (int w = 0; w < cli->nWatch; w++){
+        if (strncmp(cli->watch[w], prefix, MAXWORD) == 0){
+            cli->nWatch -= 1;
+            memmove(cli->watch[w], cli->watch[cli->nWatch], MAXWORD);
+            return st_ok;
+        }
+    }
+    return st_notfound;
+}
+
+/**
+ * watchPublish
+ * 
+ * Queue a change event for every client watching a prefix of name. Events
+ * are packed NOTIFYBATCH to a frame and written out by watchFlush; if a
+ * watcher already has WATCHQUEUE frames waiting the event is dropped and
+ * counted, and the count goes out in its next frame.
+*/
+void watchPublish(serverState *srv, KIND op, const char *name, int version){
+    for (int c = 0; c < NCLIENT; c++){
+        cliState *cli = &srv->clients[c];
+        int match = 0;
+        for (int w = 0; w < cli->nWatch && !match; w++){
+            match = (strncmp(name, cli->watch[w], strnlen(cli->watch[w], MAXWORD)) == 0);
+        }
+        if (!match) continue;
+
+        eventMsg *batch = (cli->nNotify > 0) ? &cli->notifyQ[cli->nNotify - 1].data.package.mEvents : NULL;
+        if (batch == NULL || batch->count == NOTIFYBATCH){
+            if (cli->nNotify == WATCHQUEUE){
+                cli->dropped++;
+                continue;
+            }
+            FRAME *frame = &cli->notifyQ[cli->nNotify++];
+            memset(frame, 0, sizeof(FRAME));
+            frame->kind = notify;
+            frame->data.TYPE = 5;
+            batch = &frame->data.package.mEvents;
+            batch->dropped = cli->dropped;
+            cli->dropped = 0;
+        }
+        batch->events[batch->count].op = op;
+        batch->events[batch->count].version = version;
+        strncpy(batch->events[batch->count].name, name, MAXWORD);
+        batch->count++;
+    }
+}
+
+/**
+ * watchFlush
+ * 
+ * Move a client's waiting notify frames into its reply queue, as many as
+ * fit under the high-water mark; the rest wait for the queue to drain, so
+ * a watcher that stops reading only loses events (counted) and can never
+ * block the server.
+*/
+void watchFlush(cliState *cli){
+    if (cli->nNotify == 0) return;
+
+    int nFit = REPLYHIGHWATER - cli->replies.n;
+    if (nFit <= 0) return;
+    if (nFit > cli->nNotify) nFit = cli->nNotify;
+
+    queuePush(&cli->replies, cli->notifyQ, nFit);
+    cli->nNotify -= nFit;
+    memmove(cli->notifyQ, &cli->notifyQ[nFit], cli->nNotify * sizeof(FRAME));
+
+    //let the watcher know about events lost while it was behind
+    if (cli->nNotify == 0 && cli->dropped > 0){
+        FRAME *frame = &cli->notifyQ[cli->nNotify++];
+        memset(frame, 0, sizeof(FRAME));
+        frame->kind = notify;
+        frame->data.TYPE = 5;
+        frame->data.package.mEvents.dropped = cli->dropped;
+        cli->dropped = 0;
+    }
+}
+
+/**
+ * sendRequest
+ * 
+ * Write a client request as it stands, with its sequence number and deadline.
+*/
+void sendRequest(int fd, FRAME *frame){
+    ssize_t nwrote = write(fd, (char *) frame, sizeof(FRAME));
+    if (nwrote != sizeof(FRAME)){
+        printf("sendRequest error: %zd wrote; %s on fd %d\n", nwrote, strerror(errno), fd);
+    }
+}
+
+/**
+ * callStamp
+ * 
+ * Give a request the client's next sequence number and, with -D, a
+ * deadline from now. A retry is stamped again: it is a new request, and
+ * a late reply to the old one is told apart by its number.
+*/
+void callStamp(FRAME *frame){
+    frame->seq = ++clientCalls.lastSeq;
+    frame->deadline = (clientCalls.timeoutMs > 0) ? monotonicMs() + clientCalls.timeoutMs : 0;
+    clientCalls.sent++;
+}
+
+/**
+ * callRetry
+ * 
+ * A request got no reply by its deadline. Retry it only if running it
+ * twice is harmless: reads and control requests are. Puts and deletes
+ * are not, even with no version condition: such a put only creates, so a
+ * retry of one that did get applied fails, and a retried write could
+ * overtake a later one to the same name. Back off first, by a random wait
+ * of up to RETRYBASE ms doubled for each try (at most RETRYCAP), so
+ * retries don't pile onto a server that is already behind.
+ * 
+ * returns 1 to send it again, 0 to give up
+*/
+int callRetry(FRAME *request, int tries){
+    clientCalls.timedOut++;
+    printf(CTAG "%s seq [%d] got no reply in [%d] ms.\n", commandList[request->kind], request->seq, clientCalls.timeoutMs);
+
+    int safe = (request->kind != put && request->kind != delete);
+    if (!safe || tries >= clientCalls.retries){
+        clientCalls.failed++;
+        printf(CTAG "giving up on %s seq [%d] after [%d] retries.\n", commandList[request->kind], request->seq, tries);
+        return 0;
+    }
+
+    int backoff = (tries < 16) ? RETRYBASE << tries : RETRYCAP;
+    if (backoff > RETRYCAP) backoff = RETRYCAP;
+    backoff = 1 + rand() % backoff;
+    printf(CTAG "retrying %s in [%d] ms.\n", commandList[request->kind], backoff);
+    poll(NULL, 0, backoff);
+    clientCalls.retried++;
+    return 1;
+}
+
+/**
+ * shardRecv
+ * 
+ * Read the next reply frame to request seq from a shard, handling any
+ * invalidations and notifications that come first, and dropping replies
+ * to requests already given up or retried. A reply to a later request
+ * means the server dropped this one; it is kept for that request.
+ * 
+ * returns 1 with the frame, or 0 if there was none by deadline (0: wait
+ * forever) or the request was dropped
+*/
+int shardRecv(shardLink *shard, int seq, long deadline, FRAME *frame){
+    for (;;){
+        if (shard->hasHeld){
+            *frame = shard->held;
+            shard->hasHeld = 0;
+        }
+        else {
+            if (deadline > 0){
+                long left = deadline - monotonicMs();
+                struct pollfd replyFD = {.fd = shard->servFD, .events = POLLIN};
+                if (poll(&replyFD, 1, (left > 0) ? left : 0) <= 0) return 0;
+            }
+            *frame = receiveFrame(shard->servFD);
+        }
+
+        if (frame->kind == inval) cacheDrop(frame->data.package.mObj.name);
+        else if (frame->kind == notify) printFrame("*[C]: NOTIFY: ", frame);
+        else if (frame->kind == invalid || frame->seq == seq) return 1;
+        else if (frame->seq < seq){
+            clientCalls.stale++;
+            printf(CTAG "dropped a late reply to seq [%d].\n", frame->seq);
+        }
+        else {
+            shard->held = *frame;
+            shard->hasHeld = 1;
+            return 0;
+        }
+    }
+}
+
+/**
+ * shardCall
+ * 
+ * Send a request that isn't pipelined and read the first frame of its
+ * reply, retrying as callRetry allows.
+ * 
+ * returns 1 with the reply, 0 if the request was given up
+*/
+int shardCall(shardLink *shard, FRAME *request, FRAME *reply){
+    for (int tries = 0; ; tries++){
+        callStamp(request);
+        sendRequest(shard->cliFD, request);
+        if (shardRecv(shard, request->seq, request->deadline, reply)) return 1;
+        if (!callRetry(request, tries)) return 0;
+    }
+}
+
+/**
+ * clientWait
+ * 
+ * Sleep for millisec milliseconds, printing notify frames from any shard
+ * as they arrive.
+*/
+void clientWait(shardLink *shards, int nShards, int millisec){
+    struct timespec now, end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += millisec / 1000;
+    end.tv_nsec += (millisec % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L){ end.tv_sec++; end.tv_nsec -= 1000000000L; }
+
+    struct pollfd waitFDs[MAXSHARD];
+    for (int s = 0; s < nShards; s++){
+        waitFDs[s].fd = shards[s].servFD;
+        waitFDs[s].events = POLLIN;
+    }
+    for (;;){
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long left = (end.tv_sec - now.tv_sec) * 1000 + (end.tv_nsec - now.tv_nsec) / 1000000L;
+        if (left <= 0) break;
+        if (poll(waitFDs, nShards, left) <= 0) continue;
+        for (int s = 0; s < nShards; s++){
+            if (!(waitFDs[s].revents & POLLIN)) continue;
+            FRAME frame = receiveFrame(waitFDs[s].fd);
+            if (frame.kind == notify) printFrame("*[C]: NOTIFY: ", &frame);
+            else if (frame.kind == inval) cacheDrop(frame.data.package.mObj.name);
+            else printFrame("*[C]: unexpected: ", &frame);
+        }
+    }
+}
+
+/**
+ * shardOf
+ * 
+ * Jump consistent hash (Lamping and Veach) of an object name: the shard,
+ * 0 to nShards-1, that holds it. Going from n to n+1 shards moves only the
+ * 1/(n+1) of names that now belong on the new shard.
+*/
+int shardOf(const char *name, int nShards){
+    uint64_t key = nameHash(name);
+    int64_t bucket = -1, next = 0;
+    while (next < nShards){
+        bucket = next;
+        key = key * 2862933555777941757ULL + 1;
+        next = (bucket + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1));
+    }
+    return bucket;
+}
+
+/**
+ * shardSend
+ * 
+ * Send a put, get or delete to its shard, then read replies until fewer
+ * than depth are outstanding; at depth 1 that is the reply to this
+ * request, so requests run one at a time.
+*/
+void shardSend(shardLink *shard, FRAME *frame, int depth, int leaseMs){
+    shardIssue(shard, frame, 0);
+    while (shard->n >= depth) shardReply(shard, leaseMs);
+}
+
+/**
+ * shardQuiet
+ * 
+ * Send a put or delete that asks for no reply: it isn't pending, has no
+ * deadline (nobody would hear that it was dropped), and is never retried.
+*/
+void shardQuiet(shardLink *shard, FRAME *frame){
+    callStamp(frame);
+    frame->deadline = 0;
+    frame->flags |= FR_NOREPLY;
+    cacheDrop(frame->data.package.mObj.name);
+    sendRequest(shard->cliFD, frame);
+}
+
+/**
+ * shardIssue
+ * 
+ * Stamp a request, note it as pending behind the shard's others, and send it.
+*/
+void shardIssue(shardLink *shard, FRAME *frame, int tries){
+    callStamp(frame);
+    int tail = (shard->head + shard->n) % MAXPIPE;
+    shard->pending[tail] = *frame;
+    shard->sentAt[tail] = monotonicMs();
+    shard->tries[tail] = tries;
+    shard->n++;
+    sendRequest(shard->cliFD, frame);
+}
+
+/**
+ * shardReply
+ * 
+ * Read the reply to a shard's oldest outstanding request (the server
+ * answers each client in order): one frame, an ack with the version or an
+ * error, or for a found get the object, which a caching client keeps until
+ * its lease runs out. A request with no reply by its deadline goes to the
+ * back of the line as a retry, or is given up.
+*/
+void shardReply(shardLink *shard, int leaseMs){
+    FRAME request = shard->pending[shard->head];
+    long sentAt = shard->sentAt[shard->head];
+    int tries = shard->tries[shard->head];
+    shard->head = (shard->head + 1) % MAXPIPE;
+    shard->n--;
+    //a write that may have happened makes any cached copy stale
+    if (request.kind != get) cacheDrop(request.data.package.mObj.name);
+
+    FRAME gotObj = initFrame();
+    if (!shardRecv(shard, request.seq, request.deadline, &gotObj)){
+        if (callRetry(&request, tries)) shardIssue(shard, &request, tries + 1);
+        return;
+    }
+    printFrame("s msg: ", &gotObj);
+    if (gotObj.kind != get) return;
+    //the server's lease started after sentAt, so this copy expires no later than it does
+    if (leaseMs > 0) cacheStore(&gotObj.data.package.mObj, sentAt + leaseMs);
+}
+
+/**
+ * shardsFinish
+ * 
+ * Read every outstanding reply from every shard, taking whichever shard
+ * answers first (or whose oldest request's deadline comes first).
+*/
+void shardsFinish(shardLink *shards, int nShards, int leaseMs){
+    struct pollfd replyFDs[MAXSHARD];
+    for (;;){
+        int waiting = 0;
+        long now = monotonicMs();
+        long waitMs = -1;
+        for (int s = 0; s < nShards; s++){
+            replyFDs[s].fd = (shards[s].n > 0) ? shards[s].servFD : -1;
+            replyFDs[s].events = POLLIN;
+            waiting += shards[s].n;
+            if (shards[s].n == 0) continue;
+            long due = shards[s].hasHeld ? now : shards[s].pending[shards[s].head].deadline;
+            if (due > 0 && (waitMs < 0 || due - now < waitMs)) waitMs = (due > now) ? due - now : 0;
+        }
+        if (waiting == 0 || poll(replyFDs, nShards, waitMs) < 0) return;
+        now = monotonicMs();
+        for (int s = 0; s < nShards; s++){
+            if (shards[s].n == 0) continue;
+            long due = shards[s].pending[shards[s].head].deadline;
+            if ((replyFDs[s].revents & POLLIN) || shards[s].hasHeld || (due > 0 && due <= now)) shardReply(&shards[s], leaseMs);
+        }
+    }
+}
+
+/**
+ * monotonicMs
+ * 
+ * returns CLOCK_MONOTONIC in milliseconds; the clock is shared by every
+ * process on the machine, so client and server agree on lease times.
+*/
+long monotonicMs(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+/**
+ * monotonicUs
+ * 
+ * returns CLOCK_MONOTONIC in microseconds, for request wait times.
+*/
+long monotonicUs(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000L;
+}
+
+/**
+ * telemetryOpen
+ * 
+ * Create the telemetry CSV (with a header row) and open /proc/self/statm,
+ * and schedule the first sample for now.
+ * 
+ * returns 0, or -1 if the file could not be created
+*/
+int telemetryOpen(serverState *srv, const char *path){
+    if ((srv->telemetry = fopen(path, "w")) == NULL){
+        printf(STAG "Error creating telemetry file [%s]: %s.\n", path, strerror(errno));
+        return -1;
+    }
+    //samples are small and frequent: buffer them, one write per sample
+    setvbuf(srv->telemetry, NULL, _IOFBF, TELEMETRYBUFFER);
+    srv->statmFD = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+    fprintf(srv->telemetry, "ms,requests,user_ms,system_ms,rss_kb,max_rss_kb,minor_faults,major_faults,voluntary_cs,involuntary_cs");
+    for (int c = 0; c < NCLIENT; c++){
+        fprintf(srv->telemetry, ",fifo_%d_0_bytes,fifo_0_%d_bytes,replies_%d", c + 1, c + 1, c + 1);
+    }
+    fprintf(srv->telemetry, "\n");
+    srv->nextSample = monotonicMs();
+    printf(STAG "telemetry: a sample every [%d] ms to [%s].\n", srv->telemetryMs, path);
+    return 0;
+}
+
+/**
+ * telemetrySample
+ * 
+ * Append one row of resource use to the telemetry CSV: ms since start,
+ * requests served, getrusage() totals, current RSS from /proc/self/statm,
+ * FIONREAD of each client's request and reply fifo (bytes not yet read by
+ * the server, and by the client) and the replies still queued for it.
+ * Then schedule the next sample.
+*/
+void telemetrySample(serverState *srv){
+    long now = monotonicMs();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    //statm: size resident shared ... in pages
+    long rssKb = -1;
+    char statm[128];
+    ssize_t nread = (srv->statmFD >= 0) ? pread(srv->statmFD, statm, sizeof(statm) - 1, 0) : -1;
+    if (nread > 0){
+        statm[nread] = '\0';
+        long pages;
+        if (sscanf(statm, "%*d %ld", &pages) == 1) rssKb = pages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+    fprintf(srv->telemetry, "%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld",
+        now - srv->startMs, srv->requests,
+        usage.ru_utime.tv_sec * 1000L + usage.ru_utime.tv_usec / 1000,
+        usage.ru_stime.tv_sec * 1000L + usage.ru_stime.tv_usec / 1000,
+        rssKb, usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt, usage.ru_nvcsw, usage.ru_nivcsw);
+    for (int c = 0; c < NCLIENT; c++){
+        int inQueued = 0, outQueued = 0;
+        if (ioctl(srv->clients[c].inFD, FIONREAD, &inQueued) < 0) inQueued = -1;
+        if (ioctl(srv->clients[c].outFD, FIONREAD, &outQueued) < 0) outQueued = -1;
+        fprintf(srv->telemetry, ",%d,%d,%d", inQueued, outQueued, srv->clients[c].replies.n);
+    }
+    fprintf(srv->telemetry, "\n");
+    fflush(srv->telemetry);
+
+    //stay on the sample grid; after a stall, skip the samples that were missed
+    srv->nextSample += srv->telemetryMs;
+    if (srv->nextSample <= now) srv->nextSample = now + srv->telemetryMs;
+}
+
+/**
+ * serverStop
+ * 
+ * SIGINT/SIGTERM handler: note the signal; the server loop sees it once its
+ * wait is interrupted and shuts down.
+*/
+void serverStop(int sig){
+    serverStopSignal = sig;
+}
+
+/**
+ * captureOpen
+ * 
+ * Start a capture file: the header now, records as requests arrive.
+ * 
+ * returns 0, or -1 if it can't be created
+*/
+int captureOpen(serverState *srv, const char *path){
+    if ((srv->capture = fopen(path, "w")) == NULL){
+        printf(STAG "Error creating capture file [%s]: %s.\n", path, strerror(errno));
+        return -1;
+    }
+    setvbuf(srv->capture, NULL, _IOFBF, CAPTUREBUFFER);
+    captureHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTUREMAGIC, sizeof(header.magic));
+    header.frameSize = sizeof(FRAME);
+    fwrite(&header, sizeof(header), 1, srv->capture);
+    srv->captureUs = monotonicUs();
+    printf(STAG "capturing requests to [%s].\n", path);
+    return 0;
+}
+
+/**
+ * captureFrame
+ * 
+ * Append one request read from cli at nowUs to the capture. Frames are
+ * mostly zeros past their name or data, so only the bytes up to the last
+ * nonzero one are kept.
+*/
+void captureFrame(serverState *srv, cliState *cli, FRAME *frame, long nowUs){
+    FRAME copy = *frame;
+    if (copy.deadline > 0) copy.deadline = (copy.deadline > nowUs / 1000) ? copy.deadline - nowUs / 1000 : 1;
+    const unsigned char *bytes = (const unsigned char *)&copy;
+    int len = sizeof(FRAME);
+    while (len > 0 && bytes[len - 1] == 0) len--;
+
+    captureRecord record;
+    memset(&record, 0, sizeof(record));
+    long gap = nowUs - srv->captureUs;
+    record.gapUs = (gap < 0) ? 0 : (gap > UINT32_MAX) ? UINT32_MAX : gap;
+    record.len = len;
+    record.client = cli->id;
+    srv->captureUs = nowUs;
+    fwrite(&record, sizeof(record), 1, srv->capture);
+    fwrite(bytes, len, 1, srv->capture);
+    srv->captured++;
+    srv->captureBytes += sizeof(record) + len;
+}
+
+/**
+ * replFrame
+ * 
+ * Build a replication control frame. step says what it is:
+ *  put: primary to replica, a snapshot follows; drop everything first;
+ *  done: primary to replica, "you are at change seq of this epoch" (after a
+ *      snapshot, before a catch-up from the log, and every REPLBEAT ms);
+ *  get: replica to primary, "I have applied change seq of this epoch" (the
+ *      first one asks to be caught up).
+*/
+FRAME replFrame(KIND step, int epoch, int seq){
+    FRAME frame = initFrame();
+    frame.kind = repl;
+    frame.data = packIntM(epoch, step, seq);
+    return frame;
+}
+
+/**
+ * replListen
+ * 
+ * Primary: listen on srv->replPath for replicas and set up the change log.
+ * 
+ * returns 0, or -1 if the socket could not be set up
+*/
+int replListen(serverState *srv){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, srv->replPath, sizeof(addr.sun_path) - 1);
+    unlink(srv->replPath);
+
+    srv->listenFD = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (srv->listenFD < 0 || bind(srv->listenFD, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(srv->listenFD, MAXREPLICA) < 0){
+        printf(STAG "Error listening for replicas on [%s]: %s.\n", srv->replPath, strerror(errno));
+        return -1;
+    }
+    srv->epoch = getpid();
+    srv->replLog = calloc(REPLLOG, sizeof(FRAME));
+    if (srv->replLog == NULL) return -1;
+    printf(STAG "primary: replicas connect to [%s], epoch [%d].\n", srv->replPath, srv->epoch);
+    return 0;
+}
+
+/**
+ * replConnect
+ * 
+ * Replica: connect to the primary and ask to be caught up from the last
+ * change applied (all of them if it's a different run of the primary).
+ * 
+ * returns 0, or -1 if the primary isn't there (yet)
+*/
+int replConnect(serverState *srv){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, srv->replPath, sizeof(addr.sun_path) - 1);
+
+    replLink *link = &srv->primary;
+    link->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (link->fd < 0 || connect(link->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        printf(STAG "replica: can't reach primary at [%s]: %s.\n", srv->replPath, strerror(errno));
+        linkClose(link);
+        return -1;
+    }
+    fcntl(link->fd, F_SETFL, O_NONBLOCK);
+
+    if (link->out.frames == NULL){
+        link->out.frames = calloc(REPLACKS, sizeof(FRAME));
+        link->out.size = REPLACKS;
+    }
+    FRAME hello = replFrame(get, srv->epoch, srv->replSeq);
+    queuePush(&link->out, &hello, 1);
+    printf(STAG "replica: connected to [%s], at change [%d] of epoch [%d].\n", srv->replPath, srv->replSeq, srv->epoch);
+    return 0;
+}
+
+/**
+ * replAccept
+ * 
+ * Primary: take a new replica into a free link. It is caught up once it
+ * says where it is.
+*/
+void replAccept(serverState *srv){
+    int fd = accept4(srv->listenFD, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) return;
+
+    for (int r = 0; r < MAXREPLICA; r++){
+        replLink *link = &srv->replicas[r];
+        if (link->fd >= 0) continue;
+        //room for a snapshot of a full table; changes are topped up from the log
+        if (link->out.frames == NULL){
+            link->out.frames = calloc(srv->table.size + REPLQUEUE, sizeof(FRAME));
+            if (link->out.frames == NULL) break;
+            link->out.size = srv->table.size + REPLQUEUE;
+        }
+        link->fd = fd;
+        printf(STAG "primary: replica [%d] connected.\n", r);
+        return;
+    }
+    printf(STAG "primary: no room for another replica (MAXREPLICA = %d).\n", MAXREPLICA);
+    close(fd);
+}
+
+/**
+ * replCatchUp
+ * 
+ * Primary: bring a replica that has applied change seq of epoch up to date.
+ * If it's this epoch and every change since is still in the log, it's fed
+ * those changes from the log; otherwise it's sent a snapshot of the table.
+*/
+void replCatchUp(serverState *srv, replLink *link, int epoch, int seq){
+    FRAME frame;
+    link->synced = 1;
+
+    if (epoch == srv->epoch && seq <= srv->replSeq && srv->replSeq - seq <= REPLLOG){
+        frame = replFrame(done, srv->epoch, seq);
+        queuePush(&link->out, &frame, 1);
+        link->applied = seq;
+        link->next = seq + 1;
+        printf(STAG "primary: replica catching up from the log: changes [%d] to [%d].\n", seq + 1, srv->replSeq);
+        replFeed(srv, link);
+        return;
+    }
+
+    frame = replFrame(put, srv->epoch, srv->replSeq);
+    queuePush(&link->out, &frame, 1);
+    for (int slot = tableSeek(&srv->table, "", 0); slot >= 0; slot = tableNext(&srv->table, slot)){
+        sObject *obj = &srv->table.objects[slot];
+        frame = initFrame();
+        frame.kind = put;
+        frame.data = packData(obj->owner, obj->name, obj->package);
+        frame.data.package.mObj.version = obj->version;
+        queuePush(&link->out, &frame, 1);
+    }
+    frame = replFrame(done, srv->epoch, srv->replSeq);
+    queuePush(&link->out, &frame, 1);
+    link->applied = 0;
+    link->next = srv->replSeq + 1;
+    printf(STAG "primary: replica gets a snapshot: [%d] objects at change [%d].\n", srv->table.count, srv->replSeq);
+}
+
+/**
+ * replPublish
+ * 
+ * Primary: number a put or delete that just happened, keep it in the log
+ * and queue it for every replica with room.
+ * 
+ * KIND op: put (obj is the object as stored) or delete (obj->name and the
+ *  version deleted)
+*/
+void replPublish(serverState *srv, KIND op, sObject *obj){
+    srv->replSeq++;
+    FRAME *change = &srv->replLog[(srv->replSeq - 1) % REPLLOG];
+    memset(change, 0, sizeof(FRAME));
+    change->kind = op;
+    change->data = packData(obj->owner, obj->name, obj->package);
+    change->data.package.mObj.version = obj->version;
+
+    for (int r = 0; r < MAXREPLICA; r++){
+        replLink *link = &srv->replicas[r];
+        if (link->fd >= 0 && link->synced) replFeed(srv, link);
+    }
+}
+
+/**
+ * replFeed
+ * 
+ * Primary: queue a replica's next changes from the log, as many as its
+ * queue has room for. A replica so far behind that the log no longer has
+ * its next change is dropped; it gets a snapshot when it reconnects.
+ * 
+ * returns 0, or -1 if the replica was dropped
+*/
+int replFeed(serverState *srv, replLink *link){
+    if (srv->replSeq - link->next + 1 > REPLLOG){
+        printf(STAG "primary: a replica is [%d] changes behind, past the log; dropping it.\n", srv->replSeq - link->applied);
+        linkClose(link);
+        return -1;
+    }
+    for (; link->next <= srv->replSeq && link->out.n < link->out.size; link->next++){
+        queuePush(&link->out, &srv->replLog[(link->next - 1) % REPLLOG], 1);
+    }
+    return 0;
+}
+
+/**
+ * replApply
+ * 
+ * Replica: apply one frame from the primary to the table, revoking leases
+ * and notifying watchers the way a client's put or delete would.
+*/
+void replApply(serverState *srv, FRAME *frame){
+    sObject *obj = &frame->data.package.mObj;
+
+    switch (frame->kind){
+        case (put):;
+            int version = tableApply(&srv->table, obj);
+            if (version < 0) printf(STAG "replica: no room for [%s]; it won't be served here.\n", obj->name);
+            else {
+                leaseRevoke(srv, obj->name, version);
+                watchPublish(srv, put, obj->name, version);
+            }
+            if (!srv->inSnapshot) srv->replSeq++;
+            break;
+
+        case (delete):;
+            if (tableDelete(&srv->table, obj->name) >= 0){
+                leaseRevoke(srv, obj->name, obj->version);
+                watchPublish(srv, delete, obj->name, obj->version);
+            }
+            srv->replSeq++;
+            break;
+
+        case (repl):;
+            intMsg *step = &frame->data.package.mInt;
+            if (step->kind == put){
+                //a snapshot replaces everything held
+                printf(STAG "replica: loading a snapshot at change [%d].\n", step->argument);
+                srv->inSnapshot = 1;
+                int slot;
+                while ((slot = tableSeek(&srv->table, "", 0)) >= 0){
+                    sObject gone = srv->table.objects[slot];
+                    tableDelete(&srv->table, gone.name);
+                    leaseRevoke(srv, gone.name, gone.version);
+                    watchPublish(srv, delete, gone.name, gone.version);
+                }
+            }
+            else if (step->kind == done){
+                srv->inSnapshot = 0;
+                srv->replSeq = step->argument;
+                srv->epoch = step->clientID;
+                srv->lastHeard = monotonicMs();
+                FRAME ack = replFrame(get, srv->epoch, srv->replSeq);
+                queuePush(&srv->primary.out, &ack, 1);
+            }
+            break;
+
+        default:
+            printFrame(STAG "replica: unexpected frame from primary", frame);
+            break;
+    }
+}
+
+/**
+ * replBeat
+ * 
+ * Primary: send every replica its position, so it knows how current it is
+ * and acks what it has applied. Replica: try the primary again if the link
+ * is down.
+*/
+void replBeat(serverState *srv){
+    if (srv->replica){
+        if (srv->primary.fd < 0) replConnect(srv);
+        srv->nextBeat = monotonicMs() + REPLRETRY;
+        return;
+    }
+    //each replica is told the last change queued ahead of the beat
+    for (int r = 0; r < MAXREPLICA; r++){
+        replLink *link = &srv->replicas[r];
+        FRAME beat = replFrame(done, srv->epoch, link->next - 1);
+        if (link->fd >= 0 && link->synced) queuePush(&link->out, &beat, 1);
+    }
+    srv->nextBeat = monotonicMs() + REPLBEAT;
+}
+
+/**
+ * replEvents
+ * 
+ * Handle poll events on the replication slots: new replicas and their acks
+ * on a primary, the change stream on a replica.
+*/
+void replEvents(serverState *srv){
+    FRAME frames[REPLREAD];
+    int n;
+
+    if (srv->replica){
+        if (srv->primary.fd < 0 || !(srv->pollFDs[REPLPOLL].revents & (POLLIN | POLLHUP | POLLERR))) return;
+        if ((n = linkRead(&srv->primary, frames, REPLREAD)) < 0){
+            printf(STAG "replica: lost the primary; serving change [%d] until it's back.\n", srv->replSeq);
+            linkClose(&srv->primary);
+            return;
+        }
+        for (int f = 0; f < n; f++) replApply(srv, &frames[f]);
+        return;
+    }
+
+    if (srv->pollFDs[REPLPOLL].revents & POLLIN) replAccept(srv);
+    for (int r = 0; r < MAXREPLICA; r++){
+        replLink *link = &srv->replicas[r];
+        if (link->fd < 0 || srv->pollFDs[REPLPOLL + 1 + r].fd != link->fd) continue;
+        if (!(srv->pollFDs[REPLPOLL + 1 + r].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        if ((n = linkRead(link, frames, REPLREAD)) < 0){
+            printf(STAG "primary: replica [%d] disconnected.\n", r);
+            linkClose(link);
+            continue;
+        }
+        for (int f = 0; f < n; f++){
+            intMsg *step = &frames[f].data.package.mInt;
+            if (frames[f].kind != repl || step->kind != get) continue;
+            if (!link->synced) replCatchUp(srv, link, step->clientID, step->argument);
+            else link->applied = step->argument;
+        }
+    }
+}
+
+/**
+ * replStats
+ * 
+ * Add replication lag to a stats report: on a primary, how many changes
+ * each replica has yet to apply; on a replica, the change it's at and how
+ * long ago it last heard from the primary.
+*/
+void replStats(serverState *srv, statsReport *report){
+    if (srv->replica){
+        if (srv->primary.fd < 0) statsLine(report, "replica: at change [%d], primary unreachable", srv->replSeq);
+        else statsLine(report, "replica: at change [%d] of epoch [%d], heard [%ld] ms ago%s", srv->replSeq, srv->epoch,
+            monotonicMs() - srv->lastHeard, srv->inSnapshot ? ", loading" : "");
+        return;
+    }
+    statsLine(report, "primary: change [%d] of epoch [%d]", srv->replSeq, srv->epoch);
+    for (int r = 0; r < MAXREPLICA; r++){
+        replLink *link = &srv->replicas[r];
+        if (link->fd < 0) continue;
+        statsLine(report, "replica [%d]: applied [%d], behind [%d], unsent [%d]",
+            r, link->applied, srv->replSeq - link->applied, srv->replSeq - link->next + 1 + link->out.n);
+    }
+}
+
+/**
+ * linkRead
+ * 
+ * Read what a replication link has, keeping any partial frame for next
+ * time, and copy out up to max whole frames.
+ * 
+ * returns the number of frames copied out, or -1 if the link closed
+*/
+int linkRead(replLink *link, FRAME *frames, int max){
+    ssize_t nread = read(link->fd, link->in + link->inHave, sizeof(link->in) - link->inHave);
+    if (nread == 0 || (nread < 0 && errno != EAGAIN && errno != EINTR)) return -1;
+    if (nread > 0) link->inHave += nread;
+
+    int n = link->inHave / sizeof(FRAME);
+    if (n > max) n = max;
+    memcpy(frames, link->in, n * sizeof(FRAME));
+    link->inHave -= n * sizeof(FRAME);
+    memmove(link->in, link->in + n * sizeof(FRAME), link->inHave);
+    return n;
+}
+
+/**
+ * linkClose
+ * 
+ * Close a replication link and forget its state; its queue is kept for
+ * the next connection.
+*/
+void linkClose(replLink *link){
+    if (link->fd >= 0) close(link->fd);
+    link->fd = -1;
+    link->inHave = 0;
+    link->synced = 0;
+    link->applied = 0;
+    link->next = 0;
+    link->out.head = link->out.n = 0;
+    link->out.sent = 0;
+}
+
+/**
+ * nameHash
+ * 
+ * returns the 32-bit FNV-1a hash of an object name, over at most its first
+ * MAXWORD - 1 characters, so a name and its terminated copy (in a lease or
+ * an inval) hash alike.
+*/
+unsigned int nameHash(const char *name){
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < MAXWORD - 1 && name[i] != '\0'; i++){
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * leaseGrant
+ * 
+ * Record that a client may cache name for its lease length. Leases are
+ * kept by name (not table slot), so they outlive cache evictions, and
+ * by at most MAXWORD - 1 characters of it, terminated (two names that
+ * differ only after that share a lease, which costs a spare inval). If
+ * another live lease holds the entry it is revoked first, so the client
+ * never keeps a copy the server has stopped tracking.
+*/
+void leaseGrant(cliState *cli, const char *name){
+    leaseEntry *entry = &cli->leases[nameHash(name) % LEASESLOTS];
+    long now = monotonicMs();
+    if (entry->name[0] != '\0' && entry->until > now && strncmp(entry->name, name, MAXWORD - 1) != 0){
+        FRAME invalF = initFrame();
+        invalF.kind = inval;
+        invalF.data.TYPE = 2;
+        snprintf(invalF.data.package.mObj.name, MAXWORD, "%s", entry->name);
+        //queued behind the replies ahead of it, written with them at the end of the round
+        if (queuePush(&cli->replies, &invalF, 1) != 1){
+            printf("leaseGrant error: client [%d] reply queue full\n", cli->id);
+        }
+    }
+    snprintf(entry->name, MAXWORD, "%.*s", MAXWORD - 1, name);
+    entry->until = now + cli->leaseMs;
+}
+
+/**
+ * leaseRevoke
+ * 
+ * name has changed (now at version, or deleted at version): send an inval
+ * frame to every client still holding a lease on it. The inval is queued
+ * behind the holder's earlier replies and written at once if its fifo has
+ * room, which is before the writer is acked. A holder whose queue is backed
+ * up gets it later, so until it reads the inval it may still use its copy:
+ * for no longer than the lease (-l) it was granted.
+*/
+void leaseRevoke(serverState *srv, const char *name, int version){
+    long now = monotonicMs();
+    unsigned int hash = nameHash(name);
+    for (int c = 0; c < NCLIENT; c++){
+        cliState *cli = &srv->clients[c];
+        leaseEntry *entry = &cli->leases[hash % LEASESLOTS];
+        if (entry->name[0] == '\0' || strncmp(entry->name, name, MAXWORD - 1) != 0) continue;
+        if (entry->until > now){
+            FRAME invalF = initFrame();
+            invalF.kind = inval;
+            invalF.data.TYPE = 2;
+            snprintf(invalF.data.package.mObj.name, MAXWORD, "%.*s", MAXWORD - 1, name);
+            invalF.data.package.mObj.version = version;
+            //written now if it can be, not at the end of the round
+            if (queuePush(&cli->replies, &invalF, 1) != 1){
+                printf("leaseRevoke error: client [%d] reply queue full\n", cli->id);
+            }
+            if (srv->uring != NULL) uringSettle(srv, c);
+            queueWrite(&cli->replies, cli->outFD);
+            printf(STAG "lease on [%s] revoked from client [%d].\n", name, cli->id);
+        }
+        memset(entry, 0, sizeof(leaseEntry));
+    }
+}
+
+//objects held by a caching client
+static cacheEntry clientCache[CLIENTCACHE];
+
+/**
+ * cacheLookup
+ * 
+ * returns the cached copy of name if its lease still holds, otherwise NULL.
+*/
+cacheEntry *cacheLookup(const char *name){
+    cacheEntry *entry = &clientCache[nameHash(name) % CLIENTCACHE];
+    if (entry->obj.name[0] == '\0' || strncmp(entry->obj.name, name, MAXWORD) != 0) return NULL;
+    if (entry->until <= monotonicMs()){
+        memset(entry, 0, sizeof(cacheEntry));
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+ * cacheStore
+ * 
+ * Keep a copy of obj until the lease runs out (replacing whatever shared
+ * its entry).
+*/
+void cacheStore(sObject *obj, long until){
+    cacheEntry *entry = &clientCache[nameHash(obj->name) % CLIENTCACHE];
+    entry->obj = *obj;
+    entry->until = until;
+}
+
+/**
+ * cacheDrop
+ * 
+ * Forget any cached copy of name.
+*/
+void cacheDrop(const char *name){
+    cacheEntry *entry = &clientCache[nameHash(name) % CLIENTCACHE];
+    if (strncmp(entry->obj.name, name, MAXWORD - 1) == 0) memset(entry, 0, sizeof(cacheEntry));
+}
+
+/**
+ * clientDrain
+ * 
+ * Handle every frame already waiting from the server (invalidations and
+ * notifications) without blocking.
+*/
+void clientDrain(int fd){
+    struct pollfd drainFD = {.fd = fd, .events = POLLIN};
+    while (poll(&drainFD, 1, 0) > 0){
+        FRAME frame = receiveFrame(fd);
+        if (frame.kind == inval) cacheDrop(frame.data.package.mObj.name);
+        else if (frame.kind == notify) printFrame("*[C]: NOTIFY: ", &frame);
+        else printFrame("*[C]: unexpected: ", &frame);
+    }
+}
+
+/**
+ * benchNow
+ * 
+ * returns CLOCK_MONOTONIC in nanoseconds, for timing benchmarks.
+*/
+long benchNow(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * benchReport
+ * 
+ * Write one benchmark result as a CSV line (and echo it to stdout).
+*/
+void benchReport(FILE *out, const char *name, long iters, long elapsedNs){
+    fprintf(out, "%s,%ld,%ld,%.1f\n", name, iters, elapsedNs, (double)elapsedNs / iters);
+    printf("%-24s %10ld iters %14.1f ns/op\n", name, iters, (double)elapsedNs / iters);
+}
+
+/**
+ * runBench
+ * 
+ * Time the hot paths of the client and server and write the results to
+ * outPath as CSV (name,iterations,total_ns,ns_per_op), one line per
+ * benchmark, so runs from different commits can be compared.
+ * 
+ * returns 0, or 1 if a benchmark could not be set up
+*/
+int runBench(const char *outPath){
+    FILE *out = fopen(outPath, "w");
+    if (out == NULL){
+        printf("bench: can't open [%s]: %s.\n", outPath, strerror(errno));
+        return 1;
+    }
+    fprintf(out, "name,iterations,total_ns,ns_per_op\n");
+
+    volatile long sink = 0;     //keeps results alive so the loops aren't optimized away
+    long start;
+
+    //
+    // Tokenizer
+    //
+    char tokens[MAX_NTOKENS][MAXWORD];
+    char *tokenPointers[MAX_NTOKENS];
+    char seps[] = {'\n', ' ', '\t', '\0'};
+    char line[MAXLINE];
+    start = benchNow();
+    for (long i = 0; i < BENCHITERS; i++){
+        strcpy(line, "1 put\tvideo1.mp4 12\n");
+        sink += Tokenizer(line, tokens, seps, tokenPointers);
+    }
+    benchReport(out, "Tokenizer", BENCHITERS, benchNow() - start);
+
+    //
+    // getFrameKind (a late entry in the table)
+    //
+    char kindStr[] = "stats";
+    start = benchNow();
+    for (long i = 0; i < BENCHITERS; i++) sink += getFrameKind(kindStr);
+    benchReport(out, "getFrameKind", BENCHITERS, benchNow() - start);
+
+    //
+    // packStrM / packData
+    //
+    DATA packed;
+    start = benchNow();
+    for (long i = 0; i < BENCHITERS; i++){
+        packed = packStrM("video1.mp4: line 1", "video1.mp4: line 2", "video1.mp4: line 3");
+        sink += packed.TYPE;
+    }
+    benchReport(out, "packStrM", BENCHITERS, benchNow() - start);
+
+    strMsg lines = packed.package.mStr;
+    char objName[MAXWORD] = "video1.mp4";
+    start = benchNow();
+    for (long i = 0; i < BENCHITERS; i++){
+        packed = packData(1, objName, lines);
+        sink += packed.package.mObj.owner;
+    }
+    benchReport(out, "packData", BENCHITERS, benchNow() - start);
+
+    //
+    // sendFrame/receiveFrame round trip over a FIFO pair, through an echo process
+    //
+    char fifoOut[MAXWORD], fifoBack[MAXWORD];
+    snprintf(fifoOut, sizeof(fifoOut), "/tmp/a2p2-bench-%d-a", getpid());
+    snprintf(fifoBack, sizeof(fifoBack), "/tmp/a2p2-bench-%d-b", getpid());
+    if (mkfifo(fifoOut, 0600) < 0 || mkfifo(fifoBack, 0600) < 0){
+        printf("bench: can't create fifos: %s.\n", strerror(errno));
+        unlink(fifoOut);
+        fclose(out);
+        return 1;
+    }
+    int outFD = open(fifoOut, O_RDWR);
+    int backFD = open(fifoBack, O_RDWR);
+    pid_t echo = fork();
+    if (echo == 0){
+        //echo every frame back until a quit frame
+        FRAME frame;
+        do {
+            frame = receiveFrame(outFD);
+            sendFrame(backFD, frame.kind, &frame.data);
+        } while (frame.kind != quit && frame.kind != invalid);
+        _exit(0);
+    }
+    start = benchNow();
+    for (long i = 0; i < BENCHFIFOITERS; i++){
+        sendFrame(outFD, get, &packed);
+        FRAME frame = receiveFrame(backFD);
+        sink += frame.kind;
+    }
+    benchReport(out, "sendFrame+receiveFrame", BENCHFIFOITERS, benchNow() - start);
+    DATA quitData = packIntM(0, quit, 0);
+    sendFrame(outFD, quit, &quitData);
+    receiveFrame(backFD);
+    waitpid(echo, NULL, 0);
+    close(outFD);
+    close(backFD);
+    unlink(fifoOut);
+    unlink(fifoBack);
+
+    //
+    // object table: put, get (hit), delete on a table of BENCHOBJECTS objects
+    //
+    sTable table;
+    if (tableInit(&table, BENCHOBJECTS) < 0){
+        printf("bench: can't create object table.\n");
+        fclose(out);
+        return 1;
+    }
+    sObject *objs = calloc(BENCHOBJECTS, sizeof(sObject));
+    for (int i = 0; i < BENCHOBJECTS; i++){
+        snprintf(objs[i].name, MAXWORD, "object-%05d", (i * 7919) % BENCHOBJECTS);
+        objs[i].package = lines;
+    }
+    long rounds = BENCHITERS / BENCHOBJECTS + 1;
+
+    long putNs = 0, getNs = 0, delNs = 0;
+    for (long r = 0; r < rounds; r++){
+        start = benchNow();
+        for (int i = 0; i < BENCHOBJECTS; i++) sink += tableSet(&table, &objs[i], ANYVERSION);
+        putNs += benchNow() - start;
+
+        start = benchNow();
+        for (int i = 0; i < BENCHOBJECTS; i++) sink += tableFind(&table, objs[(i * 31) % BENCHOBJECTS].name);
+        getNs += benchNow() - start;
+
+        start = benchNow();
+        for (int i = 0; i < BENCHOBJECTS; i++) sink += tableRemove(&table, objs[i].name, ANYVERSION);
+        delNs += benchNow() - start;
+    }
+    benchReport(out, "table put", rounds * BENCHOBJECTS, putNs);
+    benchReport(out, "table get", rounds * BENCHOBJECTS, getNs);
+    benchReport(out, "table delete", rounds * BENCHOBJECTS, delNs);
+    free(objs);
+    tableFree(&table);
+
+    fclose(out);
+    printf("bench: results written to [%s].\n", outPath);
+    return 0;
+}
+
+/**
+ * replayCompare
+ * 
+ * qsort order for latencies.
+*/
+int replayCompare(const void *a, const void *b){
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * runReplay
+ * 
+ * Send the requests in a capture to the server whose fifos are in dir, each
+ * client's on its own fifo pair and in its own order, at the captured times
+ * divided by scale (or, for scale 0, as fast as replies allow), with at most
+ * depth of a client's requests awaiting replies. Requests are renumbered;
+ * replies are matched to them by sequence number, a reply to a later
+ * request meaning the earlier one was dropped. Prints what it reached.
+ * 
+ * returns 0, or 1 if the capture can't be read, memory runs out or a
+ * client's fifos can't be opened
+*/
+int runReplay(const char *path, const char *dir, double scale, int depth){
+    FILE *in = fopen(path, "r");
+    if (in == NULL){
+        printf("replay: can't open [%s]: %s.\n", path, strerror(errno));
+        return 1;
+    }
+    captureHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, CAPTUREMAGIC, sizeof(header.magic)) != 0 || header.frameSize != sizeof(FRAME)){
+        printf("replay: [%s] isn't a capture from this build.\n", path);
+        fclose(in);
+        return 1;
+    }
+
+    //everything below is released at done, whatever was reached
+    int status = 0;
+    FRAME *frames[NCLIENT];
+    long *atUs[NCLIENT];
+    replLink links[NCLIENT];
+    int toFD[NCLIENT];
+    long *latency = NULL;
+    memset(frames, 0, sizeof(frames));
+    memset(atUs, 0, sizeof(atUs));
+    memset(links, 0, sizeof(links));
+    for (int c = 0; c < NCLIENT; c++) links[c].fd = toFD[c] = -1;
+
+    //load every request, split by client: when (us from the first) and what
+    long count[NCLIENT], room[NCLIENT];
+    memset(count, 0, sizeof(count));
+    memset(room, 0, sizeof(room));
+    long total = 0, clock = 0, bytes = sizeof(header);
+    captureRecord record;
+    while (fread(&record, sizeof(record), 1, in) == 1){
+        FRAME frame = initFrame();
+        if (record.len > sizeof(FRAME) || fread(&frame, record.len, 1, in) != (record.len > 0)) break;
+        bytes += sizeof(record) + record.len;
+        clock += (total > 0) ? record.gapUs : 0;
+        if (record.client < 1 || record.client > NCLIENT) continue;
+        int c = record.client - 1;
+        if (count[c] == room[c]){
+            long grow = room[c] ? 2 * room[c] : 1024;
+            FRAME *moreFrames = realloc(frames[c], grow * sizeof(FRAME));
+            if (moreFrames != NULL) frames[c] = moreFrames;
+            long *moreAt = realloc(atUs[c], grow * sizeof(long));
+            if (moreAt != NULL) atUs[c] = moreAt;
+            if (moreFrames == NULL || moreAt == NULL){
+                printf("replay: out of memory loading [%s].\n", path);
+                status = 1;
+                break;
+            }
+            room[c] = grow;
+        }
+        frames[c][count[c]] = frame;
+        atUs[c][count[c]++] = clock;
+        total++;
+    }
+    fclose(in);
+    if (status != 0) goto done;
+    printf("replay: [%ld] requests, [%ld] bytes, over [%ld] ms captured; scale [%g]%s, depth [%d].\n",
+        total, bytes, clock / 1000, scale, (scale > 0) ? "" : " (as fast as possible)", depth);
+
+    //each client's fifos, its next request, and those awaiting replies (oldest first)
+    FRAME outBuffer[NCLIENT][MAXPIPE];
+    int seq[NCLIENT], waitSeq[NCLIENT][MAXPIPE], head[NCLIENT], waiting[NCLIENT];
+    long next[NCLIENT], waitSince[NCLIENT][MAXPIPE];
+    struct pollfd fds[2 * NCLIENT];
+    for (int c = 0; c < NCLIENT; c++){
+        links[c].out.frames = outBuffer[c];
+        links[c].out.size = MAXPIPE;
+        seq[c] = head[c] = waiting[c] = next[c] = 0;
+        if (count[c] == 0) continue;
+        char fifoCtoS[MAXLINE], fifoStoC[MAXLINE];
+        snprintf(fifoCtoS, sizeof(fifoCtoS), "%s/fifo-%d-0", dir, c + 1);
+        snprintf(fifoStoC, sizeof(fifoStoC), "%s/fifo-0-%d", dir, c + 1);
+        toFD[c] = open(fifoCtoS, O_RDWR | O_NONBLOCK);
+        links[c].fd = open(fifoStoC, O_RDWR | O_NONBLOCK);
+        if (toFD[c] < 0 || links[c].fd < 0){
+            printf("replay: can't open the fifos for client [%d] in [%s]: %s.\n", c + 1, dir, strerror(errno));
+            status = 1;
+            goto done;
+        }
+    }
+
+    latency = malloc((total + 1) * sizeof(long));
+    if (latency == NULL){
+        printf("replay: out of memory for [%ld] latencies.\n", total);
+        status = 1;
+        goto done;
+    }
+    long sent = 0, answered = 0, dropped = 0, maxLagUs = 0;
+    long start = monotonicUs(), lastReply = start;
+    for (;;){
+        //queue every request that is due, as far as each client's depth and
+        //out queue allow; requests that ask for no reply only take queue room
+        long now = monotonicUs();
+        long waitUs = -1;
+        int busy = 0;
+        for (int c = 0; c < NCLIENT; c++){
+            while (next[c] < count[c] && waiting[c] < depth && links[c].out.n < links[c].out.size){
+                long due = (scale > 0) ? start + (long)(atUs[c][next[c]] / scale) : now;
+                if (due > now){
+                    if (waitUs < 0 || due - now < waitUs) waitUs = due - now;
+                    break;
+                }
+                if (now - due > maxLagUs) maxLagUs = now - due;
+                FRAME request = frames[c][next[c]++];
+                request.seq = ++seq[c];
+                if (request.deadline > 0) request.deadline += now / 1000;
+                sent += queuePush(&links[c].out, &request, 1);
+                if (request.flags & FR_NOREPLY) continue;
+                int tail = (head[c] + waiting[c]) % MAXPIPE;
+                waitSeq[c][tail] = request.seq;
+                waitSince[c][tail] = now;
+                waiting[c]++;
+            }
+            queueWrite(&links[c].out, toFD[c]);
+            busy += waiting[c] + (count[c] - next[c]) + links[c].out.n;
+        }
+        if (busy == 0) break;
+        int nothingLeft = 1;
+        for (int c = 0; c < NCLIENT; c++) if (next[c] < count[c]) nothingLeft = 0;
+        if (nothingLeft && (now - lastReply) / 1000 >= REPLAYIDLE) break;
+
+        //wait for replies, room in a fifo, or the next request's time
+        for (int c = 0; c < NCLIENT; c++){
+            fds[c].fd = links[c].fd;
+            fds[c].events = POLLIN;
+            fds[NCLIENT + c].fd = toFD[c];
+            fds[NCLIENT + c].events = (links[c].out.n > 0) ? POLLOUT : 0;
+        }
+        int pollMs = (waitUs < 0) ? REPLAYIDLE : (int)((waitUs + 999) / 1000);
+        if (poll(fds, 2 * NCLIENT, pollMs) <= 0) continue;
+
+        now = monotonicUs();
+        for (int c = 0; c < NCLIENT; c++){
+            if (!(fds[c].revents & POLLIN)) continue;
+            FRAME replies[REPLREAD];
+            int n;
+            while ((n = linkRead(&links[c], replies, REPLREAD)) > 0){
+                for (int f = 0; f < n; f++){
+                    //notifications and invalidations aren't replies; later frames of a reply are ignored
+                    if (replies[f].seq == 0) continue;
+                    while (waiting[c] > 0 && waitSeq[c][head[c]] < replies[f].seq){
+                        dropped++;
+                        head[c] = (head[c] + 1) % MAXPIPE;
+                        waiting[c]--;
+                    }
+                    if (waiting[c] > 0 && waitSeq[c][head[c]] == replies[f].seq){
+                        latency[answered++] = now - waitSince[c][head[c]];
+                        head[c] = (head[c] + 1) % MAXPIPE;
+                        waiting[c]--;
+                        lastReply = now;
+                    }
+                }
+            }
+        }
+    }
+    long elapsedUs = monotonicUs() - start;
+    for (int c = 0; c < NCLIENT; c++) dropped += waiting[c];
+
+    qsort(latency, answered, sizeof(long), replayCompare);
+    long p50 = answered ? latency[answered / 2] : 0;
+    long p90 = answered ? latency[answered * 9 / 10] : 0;
+    long p99 = answered ? latency[answered * 99 / 100] : 0;
+    long worst = answered ? latency[answered - 1] : 0;
+    printf("replay: sent [%ld], answered [%ld], no reply [%ld] (or none asked for) in [%ld] ms: [%.0f] requests/s.\n",
+        sent, answered, dropped, elapsedUs / 1000, elapsedUs ? answered * 1e6 / elapsedUs : 0.0);
+    printf("replay: latency p50 [%ld] us, p90 [%ld] us, p99 [%ld] us, max [%ld] us; sends up to [%ld] us behind schedule.\n",
+        p50, p90, p99, worst, maxLagUs);
+
+done:
+    for (int c = 0; c < NCLIENT; c++){
+        if (toFD[c] >= 0) close(toFD[c]);
+        if (links[c].fd >= 0) close(links[c].fd);
+        free(frames[c]);
+        free(atUs[c]);
+    }
+    free(latency);
+    return status;
+}